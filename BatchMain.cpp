@@ -0,0 +1,278 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "GameMap.h"
+#include "GameMapChanger.h"
+#include "GameMapSnapshot.h"
+#include "MapRenderer.h"
+#include "ParseData.h"
+
+#include <QCommandLineParser>
+#include <QGuiApplication>
+
+namespace {
+
+struct BatchOptions
+{
+    QDir out;
+    bool png = false;
+    float scale = 4;
+    bool changes = false;
+    GameMapChanger::Options changer;
+};
+
+struct Job
+{
+    QString path;
+    // Where the outputs go under --out, without the extension: the save's path relative to the
+    // directory it was found in, so saves of the same name in different folders don't collide.
+    QString outName;
+    QJsonObject stats;
+    QString error;
+};
+
+void addCount(QJsonObject& obj, QLatin1String key, qint64 v = 1)
+{
+    obj[key] = obj.value(key).toInteger() + v;
+}
+
+QJsonObject saveStats(const GameMapSnapshot& s)
+{
+    const auto& d = s.generalSaveData;
+    QJsonObject r;
+    r["name"] = QString::fromUtf8(d.name);
+    r["seed"] = QString::fromUtf8(d.seed);
+    r["version"] = QString::fromUtf8(d.version);
+    r["villagers"] = qint64(d.villagers);
+    r["years"] = qint64(d.years);
+    r["wildlifeDifficulty"] = d.wildlifeDifficulty;
+    r["raidersDifficulty"] = d.raidersDifficulty;
+    r["pacifist"] = d.pacifist;
+
+    QJsonObject minerals;
+    for (const auto& m : s.minerals) {
+        QJsonObject e = minerals.value(mineralStr(m.type)).toObject();
+        addCount(e, QLatin1String("deposits"));
+        if (m.deep) {
+            addCount(e, QLatin1String("deep"));
+        } else {
+            addCount(e, QLatin1String("amount"), m.amount);
+        }
+        minerals[mineralStr(m.type)] = e;
+    }
+    r["minerals"] = minerals;
+
+    QJsonObject forageables;
+    for (const auto& f : s.forageables) {
+        addCount(forageables, itemStr(f.type), f.amount);
+    }
+    r["forageables"] = forageables;
+
+    QJsonObject animals;
+    for (const auto& a : s.animals) {
+        addCount(animals, baseStr(a.type));
+    }
+    r["animals"] = animals;
+
+    QJsonObject houses;
+    for (const auto& h : s.houses) {
+        addCount(houses, baseStr(h.type));
+    }
+    r["houses"] = houses;
+    r["raiders"] = qint64(s.raiders.size());
+    r["animalsSpawns"] = qint64(s.animalsSpawns.size());
+    return r;
+}
+
+void processSave(Job& job, const BatchOptions& opt)
+{
+    const QString baseName = opt.out.filePath(job.outName);
+    if ((opt.png || opt.changes) && !QFileInfo(baseName).dir().mkpath(".")) {
+        job.error = QString("cannot create %1").arg(QFileInfo(baseName).path());
+        return;
+    }
+    GameMap map;
+    if (!map.loadSave(job.path)) {
+        job.error = QString("cannot load %1").arg(job.path);
+        return;
+    }
+    QSharedPointer<const GameMapSnapshot> snapshot = map.snapshot();
+    map.closeSave();
+    job.stats = saveStats(*snapshot);
+    job.stats["file"] = job.path;
+    QJsonArray errors;
+    for (const QString& e : snapshot->errors) {
+        if (!e.isEmpty()) {
+            errors.append(e);
+        }
+    }
+    if (!errors.isEmpty()) {
+        job.stats["errors"] = errors;
+    }
+
+    if (opt.png) {
+        DrawOptions draw;
+        draw.sand = draw.clay = draw.coal = draw.iron = draw.gold = draw.stone = true;
+        draw.greens = draw.herbs = draw.roots = draw.willow = true;
+        draw.animals = draw.enemies = draw.buildings = true;
+        QImage image = renderMap(draw, snapshot, opt.scale);
+        const QString pngPath = baseName + ".png";
+        if (image.isNull() || !image.save(pngPath, "PNG")) {
+            job.error = QString("cannot write %1").arg(pngPath);
+            return;
+        }
+        job.stats["png"] = pngPath;
+    }
+    if (opt.changes) {
+        const QString savPath = baseName + ".sav";
+        GameMapChanger changer(opt.changer);
+        if (!changer.copy(job.path, savPath, {})) {
+            job.error = QString("cannot write %1").arg(savPath);
+            return;
+        }
+        job.stats["changed"] = savPath;
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    // Rendering only needs a paint device, so don't require a display.
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication a(argc, argv);
+    QCoreApplication::setApplicationName("FarthestFrontierMapBatch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Extracts stats, renders overviews and applies changes to Farthest Frontier saves.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("saves", "Save files or directories to scan for *.sav.", "<saves...>");
+    QCommandLineOption outOption({ "o", "out" }, "Output directory.", "dir", ".");
+    QCommandLineOption recursiveOption({ "r", "recursive" }, "Scan directories recursively.");
+    QCommandLineOption pngOption("png", "Render an overview <save>.png for each save.");
+    QCommandLineOption scaleOption("scale", "World units per pixel of the overview.", "scale", "4");
+    QCommandLineOption statsOption("stats", "Write metadata and resource stats to <file>.", "file");
+    QCommandLineOption threadsOption({ "j", "jobs" }, "Number of worker threads.", "n");
+    QCommandLineOption removeFoWOption("remove-fow", "Reveal the map in the written copies.");
+    QCommandLineOption removeBuildingSitesOption("remove-building-sites", "Remove building sites in the written copies.");
+    QCommandLineOption doubleMineralsOption("double-minerals", "Double minerals in the written copies.");
+    QCommandLineOption pacifistOption("pacifist", "Set pacifist mode in the written copies.", "on|off");
+    parser.addOptions({ outOption, recursiveOption, pngOption, scaleOption, statsOption, threadsOption,
+                        removeFoWOption, removeBuildingSitesOption, doubleMineralsOption, pacifistOption });
+    parser.process(a);
+
+    QTextStream err(stderr);
+    BatchOptions opt;
+    opt.out = QDir(parser.value(outOption));
+    opt.png = parser.isSet(pngOption);
+    bool ok = false;
+    opt.scale = parser.value(scaleOption).toFloat(&ok);
+    if (!ok || opt.scale <= 0) {
+        err << "Invalid scale: " << parser.value(scaleOption) << Qt::endl;
+        return 1;
+    }
+    opt.changer.removeFoW = parser.isSet(removeFoWOption);
+    opt.changer.removeBuildingSites = parser.isSet(removeBuildingSitesOption);
+    opt.changer.doubleMinerals = parser.isSet(doubleMineralsOption);
+    if (parser.isSet(pacifistOption)) {
+        const QString v = parser.value(pacifistOption);
+        if (v == "on") {
+            opt.changer.pacifist = Qt::Checked;
+        } else if (v == "off") {
+            opt.changer.pacifist = Qt::Unchecked;
+        } else {
+            err << "Invalid pacifist value: " << v << Qt::endl;
+            return 1;
+        }
+    }
+    opt.changes = opt.changer.removeFoW || opt.changer.removeBuildingSites || opt.changer.doubleMinerals
+            || opt.changer.pacifist != Qt::PartiallyChecked;
+    if (parser.isSet(threadsOption)) {
+        int n = parser.value(threadsOption).toInt();
+        if (n > 0) {
+            QThreadPool::globalInstance()->setMaxThreadCount(n);
+        }
+    }
+
+    std::vector<Job> jobs;
+    const auto flags = parser.isSet(recursiveOption) ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags;
+    for (const QString& arg : parser.positionalArguments()) {
+        QFileInfo info(arg);
+        if (info.isDir()) {
+            QStringList found;
+            QDirIterator it(arg, QStringList() << "*.sav", QDir::Files, flags);
+            while (it.hasNext()) {
+                found << it.next();
+            }
+            found.sort();
+            const QDir dir(arg);
+            for (const QString& path : found) {
+                const QString relative = dir.relativeFilePath(path);
+                jobs.push_back({ path, relative.left(relative.size() - 4), {}, {} });
+            }
+        } else {
+            jobs.push_back({ arg, info.completeBaseName(), {}, {} });
+        }
+    }
+    if (jobs.empty()) {
+        parser.showHelp(1);
+    }
+    // Refuse rather than let one save's outputs overwrite another's, or a copy overwrite its save.
+    QHash<QString, QString> outputs;
+    for (const Job& job : jobs) {
+        const QString out = QFileInfo(opt.out.filePath(job.outName)).absoluteFilePath();
+        const QString other = outputs.value(out);
+        if (!other.isEmpty()) {
+            err << job.path << " and " << other << " would both be written to " << out << Qt::endl;
+            return 1;
+        }
+        outputs.insert(out, job.path);
+        const QString target = QFileInfo(out + ".sav").canonicalFilePath();
+        if (opt.changes && !target.isEmpty() && target == QFileInfo(job.path).canonicalFilePath()) {
+            err << "Cannot write the copy of " << job.path << " over itself; choose another --out" << Qt::endl;
+            return 1;
+        }
+    }
+    if ((opt.png || opt.changes) && !opt.out.mkpath(".")) {
+        err << "Cannot create " << opt.out.path() << Qt::endl;
+        return 1;
+    }
+
+    // Workers pull saves from a shared index, so one large autosave does not hold up the rest.
+    QtConcurrent::blockingMap(jobs, [&opt](Job& job) {
+        processSave(job, opt);
+    });
+
+    int failed = 0;
+    QJsonArray summary;
+    for (const Job& job : jobs) {
+        if (!job.error.isEmpty()) {
+            err << job.error << Qt::endl;
+            ++failed;
+            continue;
+        }
+        for (const QJsonValue& e : job.stats.value("errors").toArray()) {
+            err << job.path << ": damaged, " << e.toString() << Qt::endl;
+        }
+        summary.append(job.stats);
+    }
+    if (parser.isSet(statsOption)) {
+        QSaveFile file(parser.value(statsOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(summary).toJson()) < 0 || !file.commit()) {
+            err << "Cannot write " << parser.value(statsOption) << Qt::endl;
+            return 1;
+        }
+    }
+    err << jobs.size() - failed << " of " << jobs.size() << " saves processed" << Qt::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,349 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "GameMap.h"
+#include "GameMapChanger.h"
+#include "GameMapSnapshot.h"
+#include "MapInspector.h"
+#include "MapRenderer.h"
+#include "SaveCatalog.h"
+#include "SaveDiff.h"
+#include "SaveGenerator.h"
+
+#include <QCommandLineParser>
+#include <QGuiApplication>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Counts every operator new in the process. Qt containers allocate through malloc and are not
+// included, so the numbers cover decoded vectors, shared pointers and the like.
+std::atomic<quint64> allocationCount{0};
+std::atomic<quint64> allocatedBytes{0};
+
+void* countedAlloc(std::size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* countedAlignedAlloc(std::size_t size, std::align_val_t align)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    const std::size_t a = static_cast<std::size_t>(align);
+#ifdef _WIN32
+    void* p = _aligned_malloc(size ? size : 1, a);
+#else
+    void* p = std::aligned_alloc(a, (std::max<std::size_t>(size, 1) + a - 1) / a * a);
+#endif
+    if (p) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void alignedFree(void* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+struct Result
+{
+    QString name;
+    qint64 bytes = 0;
+    qint64 items = 0;
+};
+
+// Runs `f` `iterations` times after `setup`, which is neither timed nor counted.
+template<class Setup, class F>
+QJsonObject measure(const Result& what, int iterations, Setup setup, F f)
+{
+    std::vector<qint64> times;
+    quint64 allocations = 0;
+    quint64 bytes = 0;
+    for (int i = 0; i < iterations; ++i) {
+        setup();
+        const quint64 count0 = allocationCount.load();
+        const quint64 bytes0 = allocatedBytes.load();
+        QElapsedTimer timer;
+        timer.start();
+        f();
+        times.push_back(timer.nsecsElapsed());
+        allocations += allocationCount.load() - count0;
+        bytes += allocatedBytes.load() - bytes0;
+    }
+    std::sort(times.begin(), times.end());
+    const qint64 median = times[times.size() / 2];
+    QJsonObject r;
+    r["name"] = what.name;
+    r["iterations"] = iterations;
+    r["minNs"] = times.front();
+    r["medianNs"] = median;
+    r["maxNs"] = times.back();
+    if (what.bytes > 0) {
+        r["bytes"] = what.bytes;
+        r["mbPerSec"] = median ? what.bytes / 1048576.0 / (median / 1e9) : 0.0;
+    }
+    if (what.items > 0) {
+        r["items"] = what.items;
+        r["itemsPerSec"] = median ? what.items / (median / 1e9) : 0.0;
+    }
+    r["allocations"] = qint64(allocations / iterations);
+    r["allocatedBytes"] = qint64(bytes / iterations);
+    return r;
+}
+
+template<class F>
+QJsonObject measure(const Result& what, int iterations, F f)
+{
+    return measure(what, iterations, [] {}, f);
+}
+
+void clearSnapshotCache()
+{
+    QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/snapshots").removeRecursively();
+}
+
+QJsonObject paramsJson(const SaveGenerator::Params& p)
+{
+    QJsonObject r;
+    r["seed"] = qint64(p.seed);
+    r["worldSize"] = qint64(p.worldSize);
+    r["minerals"] = qint64(p.minerals);
+    r["deepMinerals"] = qint64(p.deepMinerals);
+    r["forageables"] = qint64(p.forageables);
+    r["raiders"] = qint64(p.raiders);
+    r["batteringRams"] = qint64(p.batteringRams);
+    r["animals"] = qint64(p.animals);
+    r["wolfDens"] = qint64(p.wolfDens);
+    r["shelters"] = qint64(p.shelters);
+    r["herds"] = qint64(p.herds);
+    r["spawnAreas"] = qint64(p.spawnAreas);
+    r["buildingSites"] = qint64(p.buildingSites);
+    return r;
+}
+
+QJsonArray benchSave(const QString& path, const QString& copyPath, int iterations)
+{
+    const qint64 size = QFileInfo(path).size();
+    QJsonArray r;
+    GameMap map;
+
+    r.append(measure({ "loadSave.cold", size, 0 }, iterations, [&] {
+        map.closeSave();
+        clearSnapshotCache();
+    }, [&] {
+        map.loadSave(path);
+    }));
+    r.append(measure({ "loadSave.cached", size, 0 }, iterations, [&] {
+        map.closeSave();
+    }, [&] {
+        map.loadSave(path);
+    }));
+
+    r.append(measure({ "readSaveInfo", size, 0 }, iterations, [&] {
+        SaveInfo info;
+        SaveCatalog::readSaveInfo(path, info);
+    }));
+
+    auto reader = map.reader();
+    auto readerBench = [&](const char* name, auto read) {
+        const qint64 items = qint64(read().size());
+        r.append(measure({ QString("reader.") + name, 0, items }, iterations, [&] {
+            read();
+        }));
+    };
+    readerBench("minerals", [&] { return reader.minerals(); });
+    readerBench("forageables", [&] { return reader.forageables(); });
+    readerBench("raiders", [&] { return reader.raiders(); });
+    readerBench("animals", [&] { return reader.animals(); });
+    readerBench("houses", [&] { return reader.houses(); });
+    readerBench("animalsSpawns", [&] { return reader.animalsSpawns(); });
+    readerBench("heightMap", [&] { return reader.heightMap().heights; });
+    {
+        const AgricultureInfo::Data data = reader.agricultureData();
+        r.append(measure({ "reader.agricultureData", 0, qint64(data.width()) * data.height() }, iterations, [&] {
+            reader.agricultureData();
+        }));
+    }
+    r.append(measure({ "reader.generalSaveData", 0, 0 }, iterations, [&] {
+        reader.generalSaveData();
+    }));
+    r.append(measure({ "reader.camera", 0, 0 }, iterations, [&] {
+        reader.camera();
+    }));
+    r.append(measure({ "snapshot", size, 0 }, iterations, [&] {
+        GameMapSnapshot::create(map);
+    }));
+    {
+        // The same save again copies every part, so this is the floor of a follow-mode update.
+        GameMap next;
+        r.append(measure({ "followSave.unchanged", size, 0 }, iterations, [&] {
+            next.closeSave();
+        }, [&] {
+            next.followSave(path, map);
+        }));
+    }
+
+    QSharedPointer<const GameMapSnapshot> snapshot = map.snapshot();
+    {
+        const qint64 items = qint64(snapshot->minerals.size() + snapshot->forageables.size() + snapshot->animals.size()
+                                    + snapshot->raiders.size() + snapshot->houses.size());
+        r.append(measure({ "spatialIndex.build", 0, items }, iterations, [&] {
+            SpatialIndex().build(*snapshot);
+        }));
+        // Every entity matched to itself: the join without the field hash shortcut.
+        r.append(measure({ "diffSnapshots", 0, items }, iterations, [&] {
+            diffSnapshots(*snapshot, *snapshot, SpatialIndex::AllKinds);
+        }));
+        // Hover-sized lookups spread over the map.
+        const float w = snapshot->agricultureData.worldWidth;
+        const float h = snapshot->agricultureData.worldHeight;
+        constexpr int queries = 1000;
+        r.append(measure({ "spatialIndex.nearest", 0, queries }, iterations, [&] {
+            for (int i = 0; i < queries; ++i) {
+                snapshot->index.nearest(QPointF(w * (i % 37) / 37, h * (i % 41) / 41), 20, SpatialIndex::AllKinds);
+            }
+        }));
+        const QSharedPointer<const HeightMap> heightMap = map.heightMap();
+        r.append(measure({ "inspectMapPoint", 0, queries }, iterations, [&] {
+            for (int i = 0; i < queries; ++i) {
+                inspectMapPoint(*snapshot, heightMap.data(), QPointF(w * (i % 37) / 37, h * (i % 41) / 41), 20);
+            }
+        }));
+    }
+    DrawOptions opt;
+    opt.sand = opt.clay = opt.coal = opt.iron = opt.gold = opt.stone = true;
+    opt.greens = opt.herbs = opt.roots = opt.willow = true;
+    opt.animals = opt.animalsSpawns = opt.enemies = opt.buildings = true;
+    opt.fertility = 60;
+    opt.fodder = 70;
+    opt.water = 50;
+    for (float scale : { 1.0f, 2.0f, 4.0f }) {
+        const qint64 pixels = qint64(snapshot->agricultureData.worldWidth / scale) * qint64(snapshot->agricultureData.worldHeight / scale);
+        r.append(measure({ QString("renderMap.x%1").arg(scale), 0, pixels }, iterations, [&] {
+            renderMap(opt, snapshot, scale);
+        }));
+    }
+    map.closeSave();
+
+    GameMapChanger::Options changes;
+    changes.removeFoW = true;
+    changes.removeBuildingSites = true;
+    changes.doubleMinerals = true;
+    GameMapChanger changer(changes);
+    r.append(measure({ "copy", size, 0 }, iterations, [&] {
+        changer.copy(path, copyPath, {});
+    }));
+    return r;
+}
+
+}
+
+void* operator new(std::size_t size) { return countedAlloc(size); }
+void* operator new[](std::size_t size) { return countedAlloc(size); }
+void* operator new(std::size_t size, std::align_val_t align) { return countedAlignedAlloc(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return countedAlignedAlloc(size, align); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+
+int main(int argc, char *argv[])
+{
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    // Keeps the snapshot cache of the generated saves away from the user's.
+    QStandardPaths::setTestModeEnabled(true);
+    QGuiApplication a(argc, argv);
+    QCoreApplication::setApplicationName("FarthestFrontierMapBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times save loading, decoding, rendering and copying on synthetic saves.");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Comma separated world sizes to generate.", "sizes", "1280,2560,5120");
+    QCommandLineOption densityOption("density", "Entity count multiplier.", "density", "1");
+    QCommandLineOption seedOption("seed", "Generator seed.", "seed", "1");
+    QCommandLineOption iterationsOption({ "n", "iterations" }, "Runs per benchmark.", "n", "5");
+    QCommandLineOption outOption({ "o", "out" }, "Write the JSON report to <file> instead of stdout.", "file");
+    QCommandLineOption keepOption("keep", "Keep the generated saves in <dir>.", "dir");
+    parser.addOptions({ sizesOption, densityOption, seedOption, iterationsOption, outOption, keepOption });
+    parser.process(a);
+
+    QTextStream err(stderr);
+    const double density = parser.value(densityOption).toDouble();
+    const quint32 seed = parser.value(seedOption).toUInt();
+    const int iterations = std::max(1, parser.value(iterationsOption).toInt());
+
+    QTemporaryDir tempDir;
+    QDir dir(parser.isSet(keepOption) ? parser.value(keepOption) : tempDir.path());
+    if (!dir.mkpath(".")) {
+        err << "Cannot create " << dir.path() << Qt::endl;
+        return 1;
+    }
+
+    QJsonArray saves;
+    for (const QString& s : parser.value(sizesOption).split(',', Qt::SkipEmptyParts)) {
+        const uint worldSize = s.toUInt();
+        if (worldSize < 64) {
+            err << "Invalid world size: " << s << Qt::endl;
+            return 1;
+        }
+        const SaveGenerator::Params params = SaveGenerator::scaled(worldSize, density, seed);
+        const QString path = dir.filePath(QString("synthetic-%1.sav").arg(worldSize));
+        if (!SaveGenerator(params).write(path)) {
+            err << "Cannot write " << path << Qt::endl;
+            return 1;
+        }
+        err << "Benchmarking " << path << Qt::endl;
+        QJsonObject save;
+        save["params"] = paramsJson(params);
+        save["bytes"] = QFileInfo(path).size();
+        save["benchmarks"] = benchSave(path, dir.filePath(QString("synthetic-%1-copy.sav").arg(worldSize)), iterations);
+        saves.append(save);
+    }
+    clearSnapshotCache();
+
+    QJsonObject report;
+    report["qtVersion"] = QString(qVersion());
+    report["sse2"] = bool(FF_SIMD_SSE2);
+    report["threads"] = QThreadPool::globalInstance()->maxThreadCount();
+    report["saves"] = saves;
+    const QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outOption)) {
+        QSaveFile file(parser.value(outOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit()) {
+            err << "Cannot write " << parser.value(outOption) << Qt::endl;
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
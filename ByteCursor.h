@@ -0,0 +1,164 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef BYTECURSOR_H
+#define BYTECURSOR_H
+
+#include <QByteArrayView>
+#include <QtEndian>
+
+#include <limits>
+#include <type_traits>
+
+#include "DataDefines.h"
+
+// Bounds-checked little-endian reader over a byte span. It never allocates: strings come back as
+// views into the span. The first read that does not fit records where and what failed and leaves
+// the cursor failed; later reads return zeros, so a parser can check ok() once per record.
+class ByteCursor
+{
+public:
+    struct Error
+    {
+        qsizetype offset = -1;
+        qsizetype needed = 0;
+        const char* what = nullptr;
+    };
+
+    ByteCursor() = default;
+    explicit ByteCursor(QByteArrayView data)
+        : data_(data)
+    {
+    }
+
+    bool ok() const { return error_.offset < 0; }
+    bool atEnd() const { return pos_ == data_.size(); }
+    qsizetype pos() const { return pos_; }
+    qsizetype remaining() const { return data_.size() - pos_; }
+    const Error& error() const { return error_; }
+    const uchar* current() const { return reinterpret_cast<const uchar*>(data_.data()) + pos_; }
+
+    template<class T>
+    T read(const char* what = "value")
+    {
+        static_assert(std::is_arithmetic_v<T>, "read() takes integer and floating point types");
+        if (!require(sizeof(T), what)) {
+            return T();
+        }
+        const T v = qFromLittleEndian<T>(current());
+        pos_ += sizeof(T);
+        return v;
+    }
+
+    Point readPoint()
+    {
+        Point r = {};
+        if (require(3 * sizeof(float), "point")) {
+            r.x = qFromLittleEndian<float>(current());
+            r.y = qFromLittleEndian<float>(current() + 4);
+            r.z = qFromLittleEndian<float>(current() + 8);
+            pos_ += 3 * sizeof(float);
+        }
+        return r;
+    }
+
+    QByteArrayView readBytes(qsizetype size, const char* what = "bytes")
+    {
+        if (size < 0 || !require(size, what)) {
+            return QByteArrayView();
+        }
+        const QByteArrayView r = data_.sliced(pos_, size);
+        pos_ += size;
+        return r;
+    }
+
+    // A string or blob prefixed with its length as T.
+    template<class T>
+    QByteArrayView readArray(const char* what = "array")
+    {
+        const T size = read<T>(what);
+        return ok() ? readBytes(qsizetype(size), what) : QByteArrayView();
+    }
+
+    bool skip(qsizetype size, const char* what = "skip")
+    {
+        if (size < 0 || !require(size, what)) {
+            return false;
+        }
+        pos_ += size;
+        return true;
+    }
+
+    // Skips `count` fixed-size elements.
+    bool skip(quint64 count, qsizetype elementSize, const char* what)
+    {
+        if (!expect(count, elementSize, what)) {
+            return false;
+        }
+        pos_ += qsizetype(count) * elementSize;
+        return true;
+    }
+
+    // Fails the cursor unless `count` elements of at least `minSize` bytes can still follow, so a
+    // corrupt count stops the parse instead of driving a long loop or a large allocation.
+    bool expect(quint64 count, qsizetype minSize, const char* what = "count")
+    {
+        if (!ok()) {
+            return false;
+        }
+        if (minSize > 0 && count > quint64(remaining() / minSize)) {
+            fail(qsizetype(qMin<quint64>(count * quint64(minSize), std::numeric_limits<qsizetype>::max())), what);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool require(qsizetype size, const char* what)
+    {
+        if (!ok()) {
+            return false;
+        }
+        if (size > remaining()) {
+            fail(size, what);
+            return false;
+        }
+        return true;
+    }
+
+    void fail(qsizetype needed, const char* what)
+    {
+        error_.offset = pos_;
+        error_.needed = needed;
+        error_.what = what;
+    }
+
+    QByteArrayView data_;
+    qsizetype pos_ = 0;
+    Error error_;
+};
+
+template<class T>
+void appendLittleEndian(QByteArray& out, T v)
+{
+    static_assert(std::is_arithmetic_v<T>, "appendLittleEndian() takes integer and floating point types");
+    uchar bytes[sizeof(T)];
+    qToLittleEndian<T>(v, bytes);
+    out.append(reinterpret_cast<const char*>(bytes), sizeof(T));
+}
+
+inline void appendLittleEndian(QByteArray& out, const Point& p)
+{
+    appendLittleEndian(out, p.x);
+    appendLittleEndian(out, p.y);
+    appendLittleEndian(out, p.z);
+}
+
+#endif // BYTECURSOR_H
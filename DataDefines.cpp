@@ -48,3 +48,38 @@ QColor mineralColor(MineralType v)
     return QColor();
 }
 
+void AgricultureInfo::Data::resize(uint width, uint height)
+{
+    constexpr size_t Alignment = 64;
+    constexpr size_t FloatsPerLine = Alignment / sizeof(float);
+    width_ = width;
+    height_ = height;
+    planeStride_ = (size_t(width) * height + FloatsPerLine - 1) / FloatsPerLine * FloatsPerLine;
+    if (planeStride_ == 0) {
+        storage_.reset();
+        return;
+    }
+    void* planes = ::operator new(planeStride_ * Max * sizeof(float), std::align_val_t(Alignment));
+    storage_.reset(static_cast<float*>(planes), [](float* p) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    });
+}
+
+float HeightMap::sample(float worldX, float worldZ) const
+{
+    if (isEmpty()) {
+        return 0;
+    }
+    const float last = size - 1;
+    const float fx = std::clamp(worldX / CellSize, 0.0f, last);
+    const float fz = std::clamp(worldZ / CellSize, 0.0f, last);
+    const uint x0 = uint(fx);
+    const uint z0 = uint(fz);
+    const uint x1 = std::min(x0 + 1, size - 1);
+    const uint z1 = std::min(z0 + 1, size - 1);
+    const float tx = fx - x0;
+    const float tz = fz - z0;
+    const float top = at(x0, z0) + (at(x1, z0) - at(x0, z0)) * tx;
+    const float bottom = at(x0, z1) + (at(x1, z1) - at(x0, z1)) * tx;
+    return top + (bottom - top) * tz;
+}
@@ -233,15 +233,46 @@ enum DataType
     Max
 };
 
-struct Data
+// All layers of the agriculture grid in one allocation: a contiguous, cache-line aligned plane
+// per DataType, with cell (x, y) of a plane at x * height() + y. Copies share the planes.
+class Data
 {
+public:
     float worldWidth = 0;
     float worldHeight = 0;
-    std::map<DataType, std::vector<std::vector<float>>> data;
+
+    void resize(uint width, uint height);
+    bool isEmpty() const { return width_ == 0 || height_ == 0; }
+    uint width() const { return width_; }
+    uint height() const { return height_; }
+
+    const float* plane(DataType type) const { return storage_.get() + type * planeStride_; }
+    float* plane(DataType type) { return storage_.get() + type * planeStride_; }
+    float value(DataType type, uint x, uint y) const { return plane(type)[x * height_ + y]; }
+
+private:
+    uint width_ = 0;
+    uint height_ = 0;
+    size_t planeStride_ = 0;
+    std::shared_ptr<float> storage_;
 };
 
 }
 
+// Terrain height per cell of CellSize world units, stored row by row along z.
+struct HeightMap
+{
+    static constexpr float CellSize = 5;
+
+    uint size = 0;
+    std::vector<float> heights;
+
+    bool isEmpty() const { return size == 0; }
+    float at(uint x, uint z) const { return heights[size_t(z) * size + x]; }
+    // Bilinear height at a world position, clamped to the map.
+    float sample(float worldX, float worldZ) const;
+};
+
 QColor itemColor(GameItem v);
 QColor mineralColor(MineralType v);
 
@@ -1,32 +1,21 @@
-QT       += core gui widgets concurrent
-
-PRECOMPILED_HEADER = stdafx.h
-
-CONFIG += c++17
+include(FarthestFrontierMapCore.pri)
 
 SOURCES += \
-    DataDefines.cpp \
-    GameMap.cpp \
-    GameMapChanger.cpp \
     MapWidget.cpp \
-    ParseData.cpp \
+    SaveBrowser.cpp \
     SaveDialog.cpp \
     main.cpp \
-    FarthestFrontierMapFrame.cpp \
-    stdafx.cpp
+    FarthestFrontierMapFrame.cpp
 
 HEADERS += \
-    DataDefines.h \
     FarthestFrontierMapFrame.h \
-    GameMap.h \
-    GameMapChanger.h \
     MapWidget.h \
-    ParseData.h \
-    SaveDialog.h \
-    stdafx.h
+    SaveBrowser.h \
+    SaveDialog.h
 
 FORMS += \
     FarthestFrontierMapFrame.ui \
+    SaveBrowser.ui \
     SaveDialog.ui
 
 RC_FILE = FarthestFrontierMapFrame.rc
@@ -0,0 +1,14 @@
+include(FarthestFrontierMapCore.pri)
+
+TARGET = FarthestFrontierMapBatch
+
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+    BatchMain.cpp
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,13 @@
+include(FarthestFrontierMapCore.pri)
+
+TARGET = FarthestFrontierMapBench
+
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+    BenchMain.cpp \
+    SaveGenerator.cpp
+
+HEADERS += \
+    SaveGenerator.h
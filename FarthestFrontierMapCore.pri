@@ -0,0 +1,39 @@
+# Save parsing, editing and rendering shared by the GUI and the batch tool.
+
+QT       += core gui widgets concurrent
+
+PRECOMPILED_HEADER = $$PWD/stdafx.h
+
+CONFIG += c++17
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/DataDefines.cpp \
+    $$PWD/GameMap.cpp \
+    $$PWD/GameMapChanger.cpp \
+    $$PWD/GameMapSnapshot.cpp \
+    $$PWD/MapInspector.cpp \
+    $$PWD/MapRenderer.cpp \
+    $$PWD/ParseData.cpp \
+    $$PWD/SaveCatalog.cpp \
+    $$PWD/SaveDiff.cpp \
+    $$PWD/SnapshotCache.cpp \
+    $$PWD/SpatialIndex.cpp \
+    $$PWD/stdafx.cpp
+
+HEADERS += \
+    $$PWD/ByteCursor.h \
+    $$PWD/DataDefines.h \
+    $$PWD/GameMap.h \
+    $$PWD/GameMapChanger.h \
+    $$PWD/GameMapSnapshot.h \
+    $$PWD/MapInspector.h \
+    $$PWD/MapRenderer.h \
+    $$PWD/ParseData.h \
+    $$PWD/SaveCatalog.h \
+    $$PWD/SaveDiff.h \
+    $$PWD/SnapshotCache.h \
+    $$PWD/SpatialIndex.h \
+    $$PWD/StaticHash.h \
+    $$PWD/stdafx.h
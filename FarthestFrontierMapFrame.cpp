@@ -10,36 +10,41 @@
 
 #include "stdafx.h"
 #include "GameMap.h"
+#include "GameMapSnapshot.h"
 #include "FarthestFrontierMapFrame.h"
 #include "ui_FarthestFrontierMapFrame.h"
 #include "MapWidget.h"
+#include "SaveBrowser.h"
+#include "SaveDiff.h"
 #include "SaveDialog.h"
 #include "GameMapChanger.h"
+#include "ParseData.h"
 
 namespace {
 
 const QLatin1String WindowTitle("Farthest Frontier Map");
 const QLatin1String SelectlocationStr("Select location on map");
+// How long a save must stay untouched before follow mode reads it.
+constexpr int FollowSettleMs = 300;
 
-
-QLatin1String mineralStr(MineralType v)
+// One line of the comparison summary, empty when nothing of `kind` changed.
+QString diffSummary(const SaveDiff& diff, EntityKind kind, const QString& name)
 {
-    switch (v)
-    {
-    case MineralType::Iron:
-        return QLatin1String("Iron");
-    case MineralType::Gold:
-        return QLatin1String("Gold");
-    case MineralType::Coal:
-        return QLatin1String("Coal");
-    case MineralType::Clay:
-        return QLatin1String("Clay");
-    case MineralType::Sand:
-        return QLatin1String("Sand");
-    case MineralType::Stone:
-        return QLatin1String("Stone");
-    }
-    return QLatin1String();
+    if (diff.skipped & SpatialIndex::kindMask(kind)) {
+        return QString();
+    }
+    QStringList parts;
+    auto add = [&](EntityDiff::Change change, const char* what) {
+        const uint n = diff.count(kind, change);
+        if (n > 0) {
+            parts << QString("%1 %2").arg(n).arg(what);
+        }
+    };
+    add(EntityDiff::Added, "new");
+    add(EntityDiff::Removed, "gone");
+    add(EntityDiff::Moved, "moved");
+    add(EntityDiff::AmountChanged, "changed amount");
+    return parts.isEmpty() ? QString() : QString("%1: %2\n").arg(name, parts.join(", "));
 }
 
 void addPixmap(QColor c, QLabel* label)
@@ -147,6 +152,17 @@ FarthestFrontierMapFrame::FarthestFrontierMapFrame(QWidget* parent)
         dir.cd("Save");
         saveDirectory_ = dir.path();
     }
+
+    connect(&catalog_, &SaveCatalog::updated, this, &FarthestFrontierMapFrame::catalogUpdated);
+    catalog_.setDirectory(saveDirectory_);
+
+    followTimer_.setSingleShot(true);
+    followTimer_.setInterval(FollowSettleMs);
+    connect(&followTimer_, &QTimer::timeout, &catalog_, &SaveCatalog::refresh);
+    connect(&saveWatcher_, &QFileSystemWatcher::directoryChanged, this, [this]() {
+        watchSaveDirectory();
+        followTimer_.start();
+    });
 }
 
 FarthestFrontierMapFrame::~FarthestFrontierMapFrame()
@@ -162,18 +178,98 @@ void FarthestFrontierMapFrame::on_actionOpenSav_triggered()
 
 void FarthestFrontierMapFrame::on_actionOpenLastSav_triggered()
 {
-    QDirIterator it(saveDirectory_, QStringList() << "*.sav", QDir::Files, QDirIterator::Subdirectories);
-    QString last;
-    QDateTime lastDate = QDateTime::fromSecsSinceEpoch(0);
+    // The stored catalog shown before the first refresh may miss saves made since it was stored.
+    const SaveInfo* last = catalog_.isCurrent() ? catalog_.last() : nullptr;
+    if (last != nullptr) {
+        openSav(last->path);
+        return;
+    }
+    openLastPending_ = true;
+    statusBar()->showMessage("Looking for saves...");
+    catalog_.refresh();
+}
+
+void FarthestFrontierMapFrame::on_actionBrowseSavs_triggered()
+{
+    SaveBrowser browser(catalog_, this);
+    if (browser.exec() == QDialog::Accepted) {
+        openSav(browser.selectedPath());
+    }
+}
+
+void FarthestFrontierMapFrame::catalogUpdated()
+{
+    if (openLastPending_ && catalog_.isCurrent()) {
+        openLastPending_ = false;
+        if (const SaveInfo* last = catalog_.last()) {
+            statusBar()->clearMessage();
+            openSav(last->path);
+        } else {
+            statusBar()->showMessage("No saves found", 5000);
+        }
+    }
+    if (ui->actionFollowSaves->isChecked()) {
+        followLastSav();
+    }
+}
+
+void FarthestFrontierMapFrame::on_actionFollowSaves_toggled(bool checked)
+{
+    if (!checked) {
+        followTimer_.stop();
+        const QStringList watched = saveWatcher_.directories();
+        if (!watched.isEmpty()) {
+            saveWatcher_.removePaths(watched);
+        }
+        return;
+    }
+    watchSaveDirectory();
+    catalog_.refresh();
+}
+
+// Saves are kept in a directory per settlement, so watch those as well as the save directory.
+void FarthestFrontierMapFrame::watchSaveDirectory()
+{
+    QStringList dirs(saveDirectory_);
+    QDirIterator it(saveDirectory_, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
     while (it.hasNext()) {
-        QString filename = it.next();
-        QFileInfo info(filename);
-        if (info.lastModified() > lastDate) {
-            lastDate = info.lastModified();
-            last = filename;
+        dirs << it.next();
+    }
+    const QStringList watched = saveWatcher_.directories();
+    for (const QString& dir : dirs) {
+        if (!watched.contains(dir)) {
+            saveWatcher_.addPath(dir);
         }
     }
-    openSav(last);
+}
+
+void FarthestFrontierMapFrame::followLastSav()
+{
+    const SaveInfo* last = catalog_.last();
+    if (last == nullptr) {
+        return;
+    }
+    const QString fileName = last->path;
+    const QDateTime modified = QDateTime::fromMSecsSinceEpoch(last->modified);
+    if (modified.msecsTo(QDateTime::currentDateTime()) < FollowSettleMs) {
+        followTimer_.start();
+        return;
+    }
+    if (!map_.isNull() && fileName == map_->saveFileName() && modified == followedModified_) {
+        return;
+    }
+    followedModified_ = modified;
+    if (map_.isNull() || map_->saveFileName().isEmpty()) {
+        openSav(fileName);
+        return;
+    }
+    auto map = QSharedPointer<GameMap>::create();
+    if (!map->followSave(fileName, *map_)) {
+        return;
+    }
+    map_ = map;
+    mapStateChanged(true);
+    showSnapshot();
 }
 
 void FarthestFrontierMapFrame::openSav(const QString& fileName)
@@ -185,17 +281,34 @@ void FarthestFrontierMapFrame::openSav(const QString& fileName)
         QMessageBox::critical(this, windowTitle(), "Can't open file");
         return;
     }
+    const QSharedPointer<const GameMapSnapshot> snapshot = map_->snapshot();
+    if (snapshot->hasErrors()) {
+        QStringList errors;
+        for (const QString& e : snapshot->errors) {
+            if (!e.isEmpty()) {
+                errors << e;
+            }
+        }
+        QMessageBox::warning(this, windowTitle(), QString("The save looks damaged; parts of the map may be missing.\n\n%1").arg(errors.join('\n')));
+    }
 
     mapStateChanged(true);
+    showSnapshot();
+}
 
-    auto reader = map_->reader();
-    auto saveData = reader.generalSaveData();
+void FarthestFrontierMapFrame::showSnapshot()
+{
+    snapshot_ = map_->snapshot();
+    ui->mapWidget->setHeightMapSource([map = map_]() {
+        return map->heightMap();
+    });
+    const auto& saveData = snapshot_->generalSaveData;
     if (saveData.version.compare("v0.9.1") < 0) {
         QMessageBox::critical(this, windowTitle(), QString("Incompatible version: %1").arg(saveData.version));
         return;
     }
-    updateStats(mineralsLabels, reader.minerals());
-    updateStats(itemLabels, reader.forageables());
+    updateStats(mineralsLabels, snapshot_->minerals);
+    updateStats(itemLabels, snapshot_->forageables);
     ui->textEdit->setPlainText(QString("name: %1\nseed: %2\nversion: %3\nvillagers: %4\n???: %5\n???: %6\nwildlife: %7\nraiders: %8\npacifist: %9\nyears: %10\n")
                                .arg(saveData.name).arg(saveData.seed).arg(saveData.version).arg(saveData.villagers).arg(saveData.v1).arg(saveData.v2)
                                .arg(saveData.wildlifeDifficulty).arg(saveData.raidersDifficulty).arg(saveData.pacifist).arg(saveData.years));
@@ -209,7 +322,7 @@ void FarthestFrontierMapFrame::checkBoxStateChanged()
 
 void FarthestFrontierMapFrame::drawMapFromUi()
 {
-    MapWidget::DrawOptions opt;
+    DrawOptions opt;
     if (ui->groupBoxMinerals->isChecked()) {
         opt.clay = ui->checkBoxClay->isChecked();
         opt.sand = ui->checkBoxSand->isChecked();
@@ -237,20 +350,26 @@ void FarthestFrontierMapFrame::drawMapFromUi()
     opt.animals = ui->checkBoxAnimals->isChecked();
     opt.animalsSpawns = ui->checkBoxAnimalsSpawns->isChecked();
     opt.buildings = ui->checkBoxBuildings->isChecked();
-    ui->mapWidget->update(opt, map_);
+    ui->mapWidget->update(opt, snapshot_);
 }
 
 void FarthestFrontierMapFrame::mapStateChanged(bool available)
 {
     ui->actionSaveSav->setEnabled(available);
     ui->actionCloseSav->setEnabled(available);
+    ui->actionUndoPatch->setEnabled(available && GameMapChanger::canRollback(map_->saveFileName()));
     ui->toolButtonAddClay->setEnabled(available);
     ui->toolButtonAddSand->setEnabled(available);
     ui->toolButtonAddIron->setEnabled(available);
     ui->toolButtonAddCoal->setEnabled(available);
     ui->toolButtonAddGold->setEnabled(available);
+    ui->actionCompareSav->setEnabled(available);
+    ui->actionMarkReveal->setEnabled(available);
+    ui->actionMarkReveal->setChecked(false);
     pendingNewMinerals.clear();
+    pendingReveals_.clear();
     ui->mapWidget->resetHighlight();
+    ui->mapWidget->setDiff(nullptr);
     ui->stackedWidgetInfoOptions->setCurrentWidget(ui->pageInfoViewOptions);
 }
 
@@ -272,33 +391,115 @@ void FarthestFrontierMapFrame::on_actionSaveSav_triggered()
     if (!pendingNewMinerals.empty()) {
         dialog->addInfo(QString("%1 Minerals will be added").arg(pendingNewMinerals.size()));
     }
+    dialog->setRevealPoints(int(pendingReveals_.size()));
     connect(dialog, &QDialog::finished, this, [dialog, this](int result) {
         if (result != QDialog::Accepted) {
             return;
         }
+        GameMapChanger::Options options = dialog->options();
+        const auto& agricultureData = snapshot_->agricultureData;
+        if (agricultureData.worldWidth > 0 && agricultureData.worldHeight > 0) {
+            const QSizeF worldSize(agricultureData.worldWidth, agricultureData.worldHeight);
+            const QSizeF radius(dialog->revealRadius() / worldSize.width(), dialog->revealRadius() / worldSize.height());
+            auto reveal = [&](double x, double z) {
+                options.revealAreas.push_back({ QPointF(x / worldSize.width(), z / worldSize.height()), radius });
+            };
+            if (dialog->revealTownCenter()) {
+                for (const auto& h : snapshot_->houses) {
+                    if (h.type == BaseType::TownCenter) {
+                        reveal(h.p.x, h.p.z);
+                    }
+                }
+            }
+            for (const QPointF& p : pendingReveals_) {
+                reveal(p.x(), p.y());
+            }
+        }
+        GameMapChanger changer(options);
+        if (dialog->patchInPlace()) {
+            const QString fileName = map_->saveFileName();
+            switch (changer.patch(fileName, pendingNewMinerals)) {
+            case GameMapChanger::PatchResult::Patched:
+                openSav(fileName);
+                return;
+            case GameMapChanger::PatchResult::Failed:
+                QMessageBox::critical(this, windowTitle(), "Can't patch file in place");
+                return;
+            case GameMapChanger::PatchResult::NeedsCopy:
+                QMessageBox::information(this, windowTitle(), "These changes resize the save, so they can't be made in place. Choose where to save a changed copy.");
+                break;
+            }
+        }
         QString fileName = QFileDialog::getSaveFileName(this, windowTitle(), saveDirectory_, "Farthest Frontier Saves (*.sav)");
         if (fileName.isEmpty())
             return;
-        GameMapChanger changer(dialog->options());
         if (!changer.copy(map_->saveFileName(), fileName, pendingNewMinerals)) {
             QMessageBox::critical(this, windowTitle(), "Can't open file");
             return;
         }
         pendingNewMinerals.clear();
+        pendingReveals_.clear();
+        ui->actionMarkReveal->setChecked(false);
     });
     connect(dialog, &QDialog::finished, dialog, &QDialog::deleteLater);
     dialog->open();
 }
 
+void FarthestFrontierMapFrame::on_actionUndoPatch_triggered()
+{
+    const QString fileName = map_->saveFileName();
+    if (!GameMapChanger::rollback(fileName)) {
+        QMessageBox::critical(this, windowTitle(), "Can't undo changes");
+        return;
+    }
+    openSav(fileName);
+}
 
 void FarthestFrontierMapFrame::on_actionCloseSav_triggered()
 {
+    ui->actionFollowSaves->setChecked(false);
     mapStateChanged(false);
+    snapshot_.reset();
     map_->closeSave();
     ui->textEdit->setPlainText("");
     ui->mapWidget->clear();
 }
 
+void FarthestFrontierMapFrame::on_actionCompareSav_triggered()
+{
+    SaveBrowser browser(catalog_, this);
+    browser.setWindowTitle("Compare With");
+    if (browser.exec() != QDialog::Accepted || browser.selectedPath().isEmpty()) {
+        return;
+    }
+    GameMap older;
+    if (!older.openSave(browser.selectedPath())) {
+        QMessageBox::critical(this, windowTitle(), "Can't open file");
+        return;
+    }
+    if (older.reader().generalSaveData().seed != snapshot_->generalSaveData.seed) {
+        QMessageBox::critical(this, windowTitle(), "The saves are from different games");
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const auto diff = QSharedPointer<const SaveDiff>::create(diffSaves(older, *map_));
+    const qint64 elapsed = timer.elapsed();
+    ui->mapWidget->setDiff(diff);
+
+    QString summary = QString("Since %1:\n").arg(QFileInfo(browser.selectedPath()).fileName());
+    summary += diffSummary(*diff, EntityKind::Mineral, "minerals");
+    summary += diffSummary(*diff, EntityKind::Forageable, "forageables");
+    summary += diffSummary(*diff, EntityKind::Animal, "animals");
+    summary += diffSummary(*diff, EntityKind::Raider, "raiders");
+    summary += diffSummary(*diff, EntityKind::House, "buildings");
+    if (diff->entries.empty()) {
+        summary += "no changes\n";
+    }
+    ui->textEdit->append(summary);
+    statusBar()->showMessage(QString("Compared in %1 ms").arg(elapsed), 5000);
+}
+
 void FarthestFrontierMapFrame::on_toolButtonAddSand_clicked()
 {
     startAddingMineral(MineralType::Sand);
@@ -340,17 +541,24 @@ void FarthestFrontierMapFrame::on_pushButtonAddOptionsCancel_clicked()
 void FarthestFrontierMapFrame::on_mapWidget_clicked(const QPointF& position)
 {
     if (ui->stackedWidgetInfoOptions->currentWidget() != ui->pageInfoAddOptions) {
+        if (ui->actionMarkReveal->isChecked()) {
+            pendingReveals_.push_back(position);
+            ui->mapWidget->addHighlight(position.toPoint());
+            statusBar()->showMessage(QString("%1 areas marked to reveal").arg(pendingReveals_.size()), 5000);
+        }
+        return;
+    }
+    const QSharedPointer<const HeightMap> heights = map_->heightMap();
+    if (heights->isEmpty()) {
         return;
     }
     ui->mapWidget->setHighlightMouse(false);
+    // Snapped to a height grid point on the map; clicks beyond the edge take the nearest one.
+    const double last = heights->size - 1;
     Point& p = pendingNewMinerals.back().p;
-    uint hx = position.x() / 5;
-    uint hz = position.y() / 5;
-    p.x = hx * 5;
-    p.z = hz * 5;
-    auto reader = map_->reader();
-    auto heights = reader.heightMap();
-    p.y = heights[hz][hx];
+    p.x = std::floor(qBound(0.0, position.x() / HeightMap::CellSize, last)) * HeightMap::CellSize;
+    p.z = std::floor(qBound(0.0, position.y() / HeightMap::CellSize, last)) * HeightMap::CellSize;
+    p.y = heights->sample(p.x, p.z);
     ui->mapWidget->addHighlight(QPoint(p.x, p.z));
     ui->labelAddOptionsLocation->setText(QString("(%1, %2, %3)").arg(p.x).arg(p.y).arg(p.z));
     ui->pushButtonAddOptions->setEnabled(true);
@@ -11,12 +11,17 @@
 #ifndef FARTHESTFRONTIERMAPFRAME_H
 #define FARTHESTFRONTIERMAPFRAME_H
 
+#include <QDateTime>
+#include <QFileSystemWatcher>
 #include <QMainWindow>
 #include <QScopedPointer>
+#include <QTimer>
 
 #include "DataDefines.h"
+#include "SaveCatalog.h"
 
 class GameMap;
+struct GameMapSnapshot;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class FarthestFrontierMapFrame; }
@@ -35,8 +40,12 @@ private slots:
 
     void on_actionOpenSav_triggered();
     void on_actionOpenLastSav_triggered();
+    void on_actionBrowseSavs_triggered();
+    void on_actionFollowSaves_toggled(bool checked);
     void on_actionSaveSav_triggered();
+    void on_actionUndoPatch_triggered();
     void on_actionCloseSav_triggered();
+    void on_actionCompareSav_triggered();
     void on_toolButtonAddSand_clicked();
     void on_toolButtonAddClay_clicked();
     void on_toolButtonAddCoal_clicked();
@@ -50,16 +59,31 @@ private slots:
 
 private:
     void openSav(const QString& fileName);
+    void showSnapshot();
+    void catalogUpdated();
+    void watchSaveDirectory();
+    void followLastSav();
     void drawMapFromUi();
     void mapStateChanged(bool available);
 
     void startAddingMineral(MineralType type);
 
     std::vector<MineralData> pendingNewMinerals;
+    // World positions marked with Mark Areas to Reveal.
+    std::vector<QPointF> pendingReveals_;
 
     Ui::FarthestFrontierMapFrame *ui;
     QSharedPointer<GameMap> map_;
+    QSharedPointer<const GameMapSnapshot> snapshot_;
     QString saveDirectory_;
+    SaveCatalog catalog_;
+    // Open Last before the first refresh of the catalog; opens the newest save when it finishes.
+    bool openLastPending_ = false;
+    // Follow mode: directory changes restart followTimer_, which refreshes the catalog, and the
+    // newest save is opened once the game has finished writing it.
+    QFileSystemWatcher saveWatcher_;
+    QTimer followTimer_;
+    QDateTime followedModified_;
     std::unordered_map<MineralType, QLabel*> mineralsLabels;
     std::unordered_map<GameItem, QLabel*> itemLabels;
 };
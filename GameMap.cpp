@@ -10,7 +10,10 @@
 
 #include "stdafx.h"
 #include "GameMap.h"
+#include "ByteCursor.h"
+#include "GameMapSnapshot.h"
 #include "ParseData.h"
+#include "SnapshotCache.h"
 
 QPixmap GameMap::landscape() const
 {
@@ -21,34 +24,110 @@ QPixmap GameMap::landscape() const
 
 bool GameMap::loadSave(const QString& path)
 {
-    saveFile_.close();
+    QByteArrayView save;
+    if (!mapSave(path, save)) {
+        return false;
+    }
+    SnapshotCache cache(path);
+    QSharedPointer<const GameMapSnapshot> cachedSnapshot;
+    QSharedPointer<const HeightMap> cachedHeightMap;
+    if (cache.load(save, table_, fieldHashes_, cachedSnapshot, cachedHeightMap)) {
+        QMutexLocker snapshotLock(&snapshotMutex_);
+        QMutexLocker heightMapLock(&heightMapMutex_);
+        snapshot_ = cachedSnapshot;
+        heightMap_ = cachedHeightMap;
+        cacheHeightMap_ = cachedHeightMap.isNull();
+        return true;
+    }
+    readFieldTable(save);
+    hashFields();
+    // A damaged save is decoded again next time, so its errors are reported again.
+    const QSharedPointer<const GameMapSnapshot> decoded = snapshot();
+    if (decoded->hasErrors()) {
+        return true;
+    }
+    // The heights are only decoded once something draws them; heightMap() adds them to the cache.
+    cache.store(save, table_, fieldHashes_, *decoded, nullptr);
+    QMutexLocker heightMapLock(&heightMapMutex_);
+    cacheHeightMap_ = true;
+    return true;
+}
+
+bool GameMap::followSave(const QString& path, GameMap& previous)
+{
+    QByteArrayView save;
+    if (!mapSave(path, save)) {
+        return false;
+    }
+    readFieldTable(save);
+    hashFields();
+    const QSharedPointer<const GameMapSnapshot> snapshot = GameMapSnapshot::update(*this, previous);
+    // Unchanged terrain keeps the previous heights, if they were decoded at all.
+    QSharedPointer<const HeightMap> heightMap;
+    if (fieldHashes_.value(BaseType::TerrainManager) == previous.fieldHashes_.value(BaseType::TerrainManager)) {
+        QMutexLocker previousLock(&previous.heightMapMutex_);
+        heightMap = previous.heightMap_;
+    }
+    QMutexLocker snapshotLock(&snapshotMutex_);
+    QMutexLocker heightMapLock(&heightMapMutex_);
+    snapshot_ = snapshot;
+    heightMap_ = heightMap;
+    return true;
+}
+
+bool GameMap::openSave(const QString& path)
+{
+    QByteArrayView save;
+    if (!mapSave(path, save)) {
+        return false;
+    }
+    readFieldTable(save);
+    hashFields();
+    return true;
+}
+
+bool GameMap::mapSave(const QString& path, QByteArrayView& save)
+{
+    closeSave();
     saveFile_.setFileName(path);
     if (!saveFile_.open(QIODevice::ReadOnly)) {
         return false;
     }
-    savePath_ = path;
-    table_.clear();
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-
-    while(!in.atEnd()) {
-        quint8 componentType;
-        in >> componentType;
-        readArray<quint8>(in);
-        quint32 fieldSize;
-        in >> fieldSize;
-        quint32 id = 0;
-        in >> id;
-        table_[parseBaseType(id)].push_back(saveFile_.pos());
-        in.skipRawData(fieldSize - 4);
+    const qint64 size = saveFile_.size();
+    const uchar* data = size > 0 ? saveFile_.map(0, size) : nullptr;
+    if (data == nullptr) {
+        saveFile_.close();
+        return false;
     }
+    savePath_ = path;
+    save = QByteArrayView(data, size);
+    save_ = save;
     return true;
 }
 
+void GameMap::readFieldTable(QByteArrayView save)
+{
+    forEachSaveRecord(save, [&](const SaveRecord& r) {
+        table_[parseBaseType(r.id)].push_back(save.sliced(r.fieldBegin, r.fieldSize));
+    });
+}
+
 void GameMap::closeSave()
 {
+    {
+        QMutexLocker lock(&snapshotMutex_);
+        snapshot_.reset();
+    }
+    {
+        QMutexLocker lock(&heightMapMutex_);
+        heightMap_.reset();
+        cacheHeightMap_ = false;
+    }
+    fieldHashes_.clear();
+    table_.clear();
     saveFile_.close();
     savePath_.clear();
+    save_ = QByteArrayView();
 }
 
 QString GameMap::saveFileName() const
@@ -61,46 +140,108 @@ GameMap::SaveReader GameMap::reader()
     return SaveReader(*this);
 }
 
-std::vector<MineralData> GameMap::SaveReader::minerals()
+QSharedPointer<const HeightMap> GameMap::heightMap()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    QSharedPointer<const HeightMap> heightMap;
+    bool store = false;
+    {
+        QMutexLocker lock(&heightMapMutex_);
+        if (heightMap_.isNull()) {
+            heightMap_ = QSharedPointer<const HeightMap>::create(reader().heightMap());
+            store = cacheHeightMap_;
+            cacheHeightMap_ = false;
+        }
+        heightMap = heightMap_;
+    }
+    // Outside the lock, as snapshot() takes its own.
+    if (store) {
+        SnapshotCache(savePath_).store(save_, table_, fieldHashes_, *snapshot(), heightMap.data());
+    }
+    return heightMap;
+}
 
-    if (!seekFieldSaveFile(BaseType::MineralManager)) {
-        return std::vector<MineralData>();
+QSharedPointer<const GameMapSnapshot> GameMap::snapshot()
+{
+    QMutexLocker lock(&snapshotMutex_);
+    if (snapshot_.isNull()) {
+        snapshot_ = GameMapSnapshot::create(*this);
+    }
+    return snapshot_;
+}
+
+void GameMap::hashFields()
+{
+    struct TypeHash
+    {
+        BaseType type;
+        const QVector<QByteArrayView>* fields;
+        quint64 hash;
+    };
+    std::vector<TypeHash> hashes;
+    for (auto it = table_.cbegin(); it != table_.cend(); ++it) {
+        hashes.push_back({ it.key(), &it.value(), 0 });
+    }
+    // Terrain and agriculture are most of the save, so hash the types in parallel.
+    QtConcurrent::blockingMap(hashes, [](TypeHash& t) {
+        size_t h = qHash(t.fields->size());
+        for (QByteArrayView field : *t.fields) {
+            h = qHash(field, h);
+        }
+        t.hash = h;
+    });
+    fieldHashes_.clear();
+    for (const TypeHash& t : hashes) {
+        fieldHashes_[t.type] = t.hash;
     }
+}
+
+std::vector<EntityRef> GameMap::entitiesInRect(const QRectF& rect, SpatialIndex::KindMask kinds)
+{
+    return snapshot()->index.inRect(rect, kinds);
+}
 
+std::vector<EntityRef> GameMap::entitiesInRadius(const QPointF& center, float radius, SpatialIndex::KindMask kinds)
+{
+    return snapshot()->index.inRadius(center, radius, kinds);
+}
+
+std::vector<MineralData> GameMap::SaveReader::minerals()
+{
     std::vector<MineralData> r;
+    if (!seekFieldSaveFile(BaseType::MineralManager)) {
+        return r;
+    }
+    ByteCursor& in = field_;
 
-    in.skipRawData(1);
+    in.skip(1);
     MineralType dataTypes[3] = {MineralType::Clay, MineralType::Sand, MineralType::Stone};
     for (MineralType mineralType : dataTypes) {
-        quint32 count;
-        in >> count;
+        const quint32 count = in.read<quint32>("mineral count");
+        if (!in.expect(count, 21, "minerals")) {
+            return r;
+        }
         for (uint i = 0; i < count; ++i) {
             MineralData d;
             d.type = mineralType;
-            in >> d.p;
-            in >> d.r;
-            in >> d.amount;
-            in >> d.deep;
+            d.p = in.readPoint();
+            d.r = in.read<float>();
+            d.amount = in.read<quint32>();
+            d.deep = in.read<quint8>();
             r.emplace_back(d);
         }
     }
-    quint32 mineralCount;
-    in >> mineralCount;
+    const quint32 mineralCount = in.read<quint32>("mineral count");
+    if (!in.expect(mineralCount, 29, "minerals")) {
+        return r;
+    }
     for (uint i = 0; i < mineralCount; ++i) {
-        quint32 id;
-        in >> id;
-        quint32 mineral;
-        in >> mineral;
+        in.read<quint32>(); // id
         MineralData d;
-        d.type = parseMineralType(mineral);
-        in >> d.p;
-        in >> d.r;
-        in >> d.amount;
-        in >> d.deep;
+        d.type = parseMineralType(in.read<quint32>());
+        d.p = in.readPoint();
+        d.r = in.read<float>();
+        d.amount = in.read<quint32>();
+        d.deep = in.read<quint8>();
         r.emplace_back(d);
     }
     return r;
@@ -108,37 +249,38 @@ std::vector<MineralData> GameMap::SaveReader::minerals()
 
 std::vector<ForageableData> GameMap::SaveReader::forageables()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
     int index = 0;
     std::vector<ForageableData> r;
     while (seekFieldSaveFile(BaseType::ForageableResource, index++)) {
-        in.skipRawData(5);
-        quint8 tmp1;
-        in >> tmp1;
-        in.skipRawData(1 + tmp1 * 4);
-        Point p;
-        in >> p;
-        in.skipRawData(28);
-        readArray<quint8>(in); //"BerriesResource" "ForagingResource" "BushResource"
-        in.skipRawData(1);
-        uint availableItemsSize;
-        in >> availableItemsSize;
+        ByteCursor& in = field_;
+        in.skip(5);
+        const quint8 tmp1 = in.read<quint8>();
+        in.skip(1 + tmp1 * 4);
+        const Point p = in.readPoint();
+        in.skip(28);
+        in.readArray<quint8>(); //"BerriesResource" "ForagingResource" "BushResource"
+        in.skip(1);
+        const quint32 availableItemsSize = in.read<quint32>("available items count");
+        if (!in.expect(availableItemsSize, 1 + 417 + 4, "available items")) {
+            continue;
+        }
         for (uint i = 0; i < availableItemsSize; ++i) {
-            readArray<quint8>(in);
-            in.skipRawData(417);
-            uint count;
-            in >> count;
+            in.readArray<quint8>();
+            in.skip(417);
+            in.read<quint32>(); // count
+        }
+        in.skip(33);
+        const quint32 yieldsItemsSize = in.read<quint32>("yields count");
+        if (!in.expect(yieldsItemsSize, 1 + 4, "yields")) {
+            continue;
         }
-        in.skipRawData(33);
-        uint yieldsItemsSize;
-        in >> yieldsItemsSize;
         for (uint i = 0; i < yieldsItemsSize; ++i) {
             ForageableData d;
-            auto item = readArray<quint8>(in);
-            in >> d.amount;
+            const QByteArrayView item = in.readArray<quint8>("item");
+            d.amount = in.read<quint32>();
+            if (!in.ok()) {
+                break;
+            }
             d.p = p;
             d.type = parseItem(item);
             r.emplace_back(d);
@@ -149,60 +291,61 @@ std::vector<ForageableData> GameMap::SaveReader::forageables()
 
 std::vector<RaiderData> GameMap::SaveReader::raiders()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    // Looted and own item lists: name, 417 bytes of item state, count.
+    auto skipItems = [](ByteCursor& in) {
+        const quint32 size = in.read<quint32>("items count");
+        if (!in.expect(size, 1 + 417 + 4, "items")) {
+            return;
+        }
+        for (uint i = 0; i < size; ++i) {
+            in.readArray<quint8>(); // "Item..."
+            in.skip(417);
+            in.read<quint32>(); // count
+        }
+    };
 
     int index = 0;
     std::vector<RaiderData> r;
     while (seekFieldSaveFile(BaseType::Raider, index++)) {
-        in.skipRawData(6);
+        ByteCursor& in = field_;
+        in.skip(6);
         RaiderData d;
-        in >> d.p;
-        in.skipRawData(28);
-        readArray<quint8>(in); //"Raider"
-        float hp;
-        in >> hp;
-        in.skipRawData(1); // 00
-        in >> d.spawn;
-        in.skipRawData(1); // 00
-        uint lootedItemsSize;
-        in >> lootedItemsSize;
-        for (uint i = 0; i < lootedItemsSize; ++i) {
-            readArray<quint8>(in); // "Item..."
-            in.skipRawData(417);
-            uint count;
-            in >> count;
+        d.p = in.readPoint();
+        in.skip(28);
+        in.readArray<quint8>(); //"Raider"
+        d.hp = in.read<float>();
+        in.skip(1); // 00
+        d.spawn = in.readPoint();
+        in.skip(1); // 00
+        skipItems(in);
+        d.p1 = in.read<float>(); // = 250 //carry
+        in.skip(2); // 00 00
+        skipItems(in);
+        in.skip(5); // 0
+        d.p2 = in.read<float>(); // = 250 //carry?
+        const QByteArrayView u = in.readArray<quint8>("raider type");
+        if (!in.ok()) {
+            continue;
         }
-        in >> d.p1; // = 250 //carry
-        in.skipRawData(2); // 00 00
-        uint ownItemsSize;
-        in >> ownItemsSize;
-        for (uint i = 0; i < ownItemsSize; ++i) {
-            readArray<quint8>(in); // "Item..."
-            in.skipRawData(417);
-            uint count;
-            in >> count;
-        }
-        in.skipRawData(5); // 0
-        in >> d.p2; // = 250 //carry?
-        auto u = readArray<quint8>(in);
         d.type = parseRaiderType(u);
         r.emplace_back(d);
     }
     index = 0;
     while (seekFieldSaveFile(BaseType::BatteringRam, index++)) {
-        in.skipRawData(6);
+        ByteCursor& in = field_;
+        in.skip(6);
         RaiderData d;
         d.type = RaiderType::BatteringRam;
-        in >> d.p;
-        in.skipRawData(28);
-        readArray<quint8>(in); //"BatteringRam"
-        float hp;
-        in >> hp;
-        in.skipRawData(1); // 00
-        in >> d.spawn;
-        in.skipRawData(1); // 00
+        d.p = in.readPoint();
+        in.skip(28);
+        in.readArray<quint8>(); //"BatteringRam"
+        d.hp = in.read<float>();
+        in.skip(1); // 00
+        d.spawn = in.readPoint();
+        in.skip(1); // 00
+        if (!in.ok()) {
+            continue;
+        }
         r.emplace_back(d);
     }
     return r;
@@ -210,20 +353,19 @@ std::vector<RaiderData> GameMap::SaveReader::raiders()
 
 std::vector<BaseData> GameMap::SaveReader::animals()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
     const BaseType list[] = { BaseType::Deer, BaseType::Bear, BaseType::Boar, BaseType::Wolf, BaseType::WolfDen };
     std::vector<BaseData> r;
     for (BaseType i : list) {
         int index = 0;
         while (seekFieldSaveFile(i, index++)) {
-            in.skipRawData(6);
+            ByteCursor& in = field_;
+            in.skip(6);
             BaseData d;
             d.type = i;
-            in >> d.p;
-            r.emplace_back(d);
+            d.p = in.readPoint();
+            if (in.ok()) {
+                r.emplace_back(d);
+            }
         }
     }
     return r;
@@ -231,65 +373,63 @@ std::vector<BaseData> GameMap::SaveReader::animals()
 
 std::vector<BaseData> GameMap::SaveReader::houses()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
-    int index = 0;
+    const BaseType list[] = { BaseType::TownCenter, BaseType::Shelter };
     std::vector<BaseData> r;
-    while (seekFieldSaveFile(BaseType::TownCenter, index++)) {
-        in.skipRawData(7);
-        BaseData d;
-        d.type = BaseType::TownCenter;
-        in >> d.p;
-        r.emplace_back(d);
-    }
-    index = 0;
-    while (seekFieldSaveFile(BaseType::Shelter, index++)) {
-        in.skipRawData(7);
-        BaseData d;
-        d.type = BaseType::Shelter;
-        in >> d.p;
-        r.emplace_back(d);
+    for (BaseType i : list) {
+        int index = 0;
+        while (seekFieldSaveFile(i, index++)) {
+            ByteCursor& in = field_;
+            in.skip(7);
+            BaseData d;
+            d.type = i;
+            d.p = in.readPoint();
+            if (in.ok()) {
+                r.emplace_back(d);
+            }
+        }
     }
     return r;
 }
 
 std::vector<AnimalSpawnData> GameMap::SaveReader::animalsSpawns()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
     std::vector<AnimalSpawnData> r;
     if (!seekFieldSaveFile(BaseType::AnimalManager)) {
         return r;
     }
+    ByteCursor& in = field_;
 
-    in.skipRawData(2);
-    uint herdCount;
-    in >> herdCount;
+    in.skip(2);
+    const quint32 herdCount = in.read<quint32>("herd count");
+    if (!in.expect(herdCount, 1 + 4 + 1 + 15 + 1 + 45, "herds")) {
+        return r;
+    }
     for (uint i = 0; i < herdCount; ++i) {
-        in.skipRawData(1);
-        uint workerCount;
-        in >> workerCount;
-        in.skipRawData(workerCount * 4);
-        readArray<quint8>(in);
-
-        in.skipRawData(15); //barn
-        uchar center;
-        in >> center;
+        in.skip(1);
+        const quint32 workerCount = in.read<quint32>("worker count");
+        if (!in.skip(workerCount, 4, "workers")) {
+            return r;
+        }
+        in.readArray<quint8>();
+
+        in.skip(15); //barn
+        const quint8 center = in.read<quint8>();
         if (center == 1) {
-            in.skipRawData(4);
+            in.skip(4);
         }
-        in.skipRawData(45);
+        in.skip(45);
+    }
+    const quint32 areaCount = in.read<quint32>("spawn area count");
+    if (!in.expect(areaCount, 4 + 1, "spawn areas")) {
+        return r;
     }
-    quint32 areaCount;
-    in >> areaCount;
     for (uint i = 0; i < areaCount; ++i) {
         AnimalSpawnData d;
-        in >> d.spawnArea;
-        auto uuid = readArray<quint8>(in);
+        d.spawnArea = in.read<quint32>();
+        const QByteArrayView uuid = in.readArray<quint8>("spawn type");
+        if (!in.ok()) {
+            break;
+        }
         d.type = parseAnimalsSpawnType(uuid);
         r.emplace_back(d);
     }
@@ -298,120 +438,81 @@ std::vector<AnimalSpawnData> GameMap::SaveReader::animalsSpawns()
 
 GeneralSaveData GameMap::SaveReader::generalSaveData()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
-    GeneralSaveData r;
     if (!seekFieldSaveFile(BaseType::MetaData)) {
-        return r;
+        return GeneralSaveData();
     }
-    in.skipRawData(5);
-    r.version = readArray<quint8>(in);
-    r.seed = readArray<quint8>(in);
-    in >> r.v1;
-    in >> r.v2;
-    in >> r.wildlifeDifficulty;
-    in >> r.raidersDifficulty;
-    in >> r.pacifist;
-    r.name = readArray<quint8>(in);
-    in >> r.villagers;
-    in >> r.years;
-    in >> r.v3;
-    in >> r.v4;
-    in >> r.timestamp;
-    in >> r.hours;
-    in >> r.mins;
-    readArray<quint32>(in); //png
-    return r;
+    return parseGeneralSaveData(field_);
 }
 
 AgricultureInfo::Data GameMap::SaveReader::agricultureData()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
     AgricultureInfo::Data r;
     if (!seekFieldSaveFile(BaseType::AgricultureManager)) {
         return r;
     }
-    in.skipRawData(6);
-    in >> r.worldWidth;
-    in >> r.worldHeight;
-    uint width;
-    uint height;
-    in >> width;
-    in >> height;
-    for (uint t = 0; t < AgricultureInfo::Max; ++t) {
-        r.data[static_cast<AgricultureInfo::DataType>(t)].resize(width);
+    ByteCursor& in = field_;
+
+    in.skip(6);
+    r.worldWidth = in.read<float>();
+    r.worldHeight = in.read<float>();
+    const quint32 width = in.read<quint32>();
+    const quint32 height = in.read<quint32>();
+    if (!in.expect(quint64(width) * height, AgricultureInfo::Max * sizeof(float), "agriculture cells")) {
+        return r;
     }
-    for (uint i = 0; i < width; ++i) {
-        for (uint t = 0; t < AgricultureInfo::Max; ++t) {
-            r.data[static_cast<AgricultureInfo::DataType>(t)][i].resize(height);
-        }
-        for (uint j = 0; j < height; ++j) {
-            for (uint t = 0; t < AgricultureInfo::Max; ++t) {
-                float v;
-                in >> v;
-                r.data[static_cast<AgricultureInfo::DataType>(t)][i][j] = v;
-            }
-        }
+    r.resize(width, height);
+    float* planes[AgricultureInfo::Max];
+    for (uint t = 0; t < AgricultureInfo::Max; ++t) {
+        planes[t] = r.plane(static_cast<AgricultureInfo::DataType>(t));
     }
+    deinterleaveFloats(in.current(), size_t(width) * height, AgricultureInfo::Max, planes);
     return r;
 }
 
-std::vector<std::vector<float>> GameMap::SaveReader::heightMap()
+HeightMap GameMap::SaveReader::heightMap()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
-    std::vector<std::vector<float>> r;
+    HeightMap r;
     if (!seekFieldSaveFile(BaseType::TerrainManager)) {
         return r;
     }
-    auto start = saveFile_.pos();
-    in.skipRawData(1);
-    uint regrownTreeCount;
-    in >> regrownTreeCount;
-    in.skipRawData(regrownTreeCount * 96);
-    uint treeGrouthCount;
-    in >> treeGrouthCount;
-    in.skipRawData(treeGrouthCount * 104);
-    uint choppedTreeCount;
-    in >> choppedTreeCount;
-    in.skipRawData(choppedTreeCount * 12);
-    uint objectsCount;
-    in >> objectsCount;
-    in.skipRawData(objectsCount * 122);
-
-    uint count1;
-    in >> count1;
+    ByteCursor& in = field_;
+
+    in.skip(1);
+    const quint32 regrownTreeCount = in.read<quint32>();
+    in.skip(regrownTreeCount, 96, "regrown trees");
+    const quint32 treeGrouthCount = in.read<quint32>();
+    in.skip(treeGrouthCount, 104, "growing trees");
+    const quint32 choppedTreeCount = in.read<quint32>();
+    in.skip(choppedTreeCount, 12, "chopped trees");
+    const quint32 objectsCount = in.read<quint32>();
+    in.skip(objectsCount, 122, "objects");
+
+    const quint32 count1 = in.read<quint32>();
+    if (!in.expect(count1, 20 + 4 + 57, "terrain records")) {
+        return r;
+    }
     for (uint i = 0; i < count1; ++i) {
-        in.skipRawData(20);
-        uint count11;
-        in >> count11;
-        in.skipRawData(count11 * 16);
-        in.skipRawData(57);
-    }
-
-    uint mapSize;
-    in >> mapSize;
-    uint total;
-    in >> total;
-    r.resize(mapSize);
-    for (uint i = 0; i < mapSize; ++i) {
-        r[i].resize(mapSize);
-        for (uint j = 0; j < mapSize; ++j) {
-            in >> r[i][j];
-        }
+        in.skip(20);
+        const quint32 count11 = in.read<quint32>();
+        in.skip(count11, 16, "terrain points");
+        in.skip(57);
+    }
+
+    const quint32 mapSize = in.read<quint32>();
+    in.read<quint32>(); // total
+    const quint64 cellCount = quint64(mapSize) * mapSize;
+    if (!in.expect(cellCount, sizeof(float), "heights")) {
+        return r;
     }
+    r.size = mapSize;
+    r.heights.resize(cellCount);
+    qFromLittleEndian<float>(in.current(), cellCount, r.heights.data());
     return r;
 }
 
 bool GameMap::SaveReader::seekFieldSaveFile(BaseType baseType, uint index)
 {
+    keepError();
     auto i = table_.find(baseType);
     if (i == table_.end()) {
         return false;
@@ -420,36 +521,52 @@ bool GameMap::SaveReader::seekFieldSaveFile(BaseType baseType, uint index)
     if (v.size() <= index) {
         return false;
     }
-    saveFile_.seek(v[index]);
+    // The cursor reads the mapped field without copying it.
+    field_ = ByteCursor(v[index]);
+    fieldType_ = baseType;
+    fieldIndex_ = index;
     return true;
 }
 
+void GameMap::SaveReader::keepError()
+{
+    if (!field_.ok()) {
+        lastError_ = { fieldType_, fieldIndex_, field_.error() };
+        field_ = ByteCursor();
+    }
+}
+
 GameMap::SaveReader::SaveReader(GameMap &map)
     : table_(map.table_)
-    , saveFile_(map.savePath_)
 {
-    saveFile_.open(QIODevice::ReadOnly);
 }
 
-GameMap::SaveReader::~SaveReader()
+QString GameMap::SaveReader::ParseError::toString() const
 {
-    saveFile_.close();
+    return QString("field %1 #%2: %3 needs %4 bytes at offset %5")
+        .arg(baseTypeId(type))
+        .arg(index)
+        .arg(QLatin1String(error.what ? error.what : "value"))
+        .arg(error.needed)
+        .arg(error.offset);
 }
 
-Point GameMap::SaveReader::camera()
+const GameMap::SaveReader::ParseError& GameMap::SaveReader::lastError()
 {
-    QDataStream in(&saveFile_);
-    in.setByteOrder(QDataStream::LittleEndian);
-    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    keepError();
+    return lastError_;
+}
 
+Point GameMap::SaveReader::camera()
+{
     Point r;
     memset(&r, 0, sizeof(Point));
     if (!seekFieldSaveFile(BaseType::CameraManager)) {
         return r;
     }
-    in.skipRawData(1);
-    in >> r.x;
-    in >> r.y;
-    in >> r.z;
+    ByteCursor& in = field_;
+
+    in.skip(1);
+    r = in.readPoint();
     return r;
 }
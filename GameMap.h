@@ -11,20 +11,40 @@
 #ifndef GAMEMAP_H
 #define GAMEMAP_H
 
+#include "ByteCursor.h"
 #include "DataDefines.h"
+#include "SpatialIndex.h"
+
+struct GameMapSnapshot;
 
 class GameMap
 {
 public:
     bool loadSave(const QString& path);
+    // Opens a later save of the game `previous` has open. Decodes only the snapshot parts whose
+    // fields changed and takes the rest from `previous`, with its heights if the terrain is unchanged
+    // and they were decoded; skips the snapshot cache.
+    bool followSave(const QString& path, GameMap& previous);
+    // Maps the save and hashes its fields but decodes nothing and skips the snapshot cache, for
+    // reading a few fields through reader().
+    bool openSave(const QString& path);
     void closeSave();
     QString saveFileName() const;
 
     class SaveReader
     {
     public:
+        // Where a read last ran past the end of its field; error.offset is relative to the field.
+        struct ParseError
+        {
+            BaseType type = BaseType::Unknown;
+            uint index = 0;
+            ByteCursor::Error error;
+
+            QString toString() const;
+        };
+
         explicit SaveReader(GameMap& map);
-        ~SaveReader();
 
         Point camera();
         std::vector<MineralData> minerals();
@@ -35,21 +55,51 @@ public:
         std::vector<AnimalSpawnData> animalsSpawns();
         GeneralSaveData generalSaveData();
         AgricultureInfo::Data agricultureData();
-        std::vector<std::vector<float>> heightMap();
+        HeightMap heightMap();
+
+        const ParseError& lastError();
     private:
         bool seekFieldSaveFile(BaseType baseType, uint index = 0);
-        QHash<BaseType, QVector<qint64>>& table_;
-        QFile saveFile_;
+        void keepError();
+        const QHash<BaseType, QVector<QByteArrayView>>& table_;
+        ByteCursor field_;
+        BaseType fieldType_ = BaseType::Unknown;
+        uint fieldIndex_ = 0;
+        ParseError lastError_;
     };
     SaveReader reader();
 
+    // Decoded on first use and shared by every caller until the save is closed.
+    QSharedPointer<const GameMapSnapshot> snapshot();
+    QSharedPointer<const HeightMap> heightMap();
+    // A hash of the payloads of each field type, taken when the save was loaded, so it describes
+    // the decoded data even if the file has been rewritten since.
+    const QHash<BaseType, quint64>& fieldHashes() const { return fieldHashes_; }
+    // Entities of `kinds` within a world rectangle (x, z) or circle, from the snapshot's index.
+    std::vector<EntityRef> entitiesInRect(const QRectF& rect, SpatialIndex::KindMask kinds = SpatialIndex::AllKinds);
+    std::vector<EntityRef> entitiesInRadius(const QPointF& center, float radius, SpatialIndex::KindMask kinds = SpatialIndex::AllKinds);
+
     QPixmap landscape() const;
 signals:
 
 private:
+    bool mapSave(const QString& path, QByteArrayView& save);
+    void readFieldTable(QByteArrayView save);
+    void hashFields();
+
     QString savePath_;
     QFile saveFile_;
-    QHash<BaseType, QVector<qint64>> table_;
+    // The mapping of saveFile_.
+    QByteArrayView save_;
+    // Each view points into the mapping of saveFile_ and spans one field payload (after the id).
+    QHash<BaseType, QVector<QByteArrayView>> table_;
+    QMutex snapshotMutex_;
+    QSharedPointer<const GameMapSnapshot> snapshot_;
+    QMutex heightMapMutex_;
+    QSharedPointer<const HeightMap> heightMap_;
+    // The snapshot cache was stored without heights; heightMap() stores it again once decoded.
+    bool cacheHeightMap_ = false;
+    QHash<BaseType, quint64> fieldHashes_;
     QByteArray landscapeData_;
     QByteArray screenshotData_;
 
@@ -1,6 +1,106 @@
 #include "stdafx.h"
 #include "GameMapChanger.h"
 #include "ParseData.h"
+#include "ByteCursor.h"
+
+namespace {
+
+// The journal header holds the save's size and mtime (ms) after the last patch and an MD5 of the
+// patched bytes of every range, so a save the game has rewritten since isn't rolled back.
+const QByteArray UndoMagic("FFUNDO02");
+constexpr qint64 UndoHeaderSize = 8 + 8 + 8 + 16;
+// Differences closer than this are journalled and patched as one range.
+constexpr qint64 PatchGap = 16;
+
+// Sets the two visibility bytes of `count` consecutive 4-byte FoW cells.
+void revealCells(uchar* cells, size_t count)
+{
+    size_t i = 0;
+#if FF_SIMD_SSE2
+    const __m128i visible = _mm_set1_epi32(0x00ffff00);
+    for (; i + 4 <= count; i += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(cells + i * 4);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_loadu_si128(p), visible));
+    }
+#endif
+    for (; i < count; ++i) {
+        cells[i * 4 + 1] = 0xff;
+        cells[i * 4 + 2] = 0xff;
+    }
+}
+
+QString undoPath(const QString& path)
+{
+    return path + QLatin1String(".undo");
+}
+
+struct PatchRange
+{
+    qint64 offset;
+    QByteArray bytes;
+};
+
+struct UndoRange
+{
+    qint64 offset;
+    QByteArrayView original;
+};
+
+// Hashes what every journalled range holds once `pending` is written over the save.
+QByteArray patchedHash(const uchar* data, const std::vector<UndoRange>& journalled, const std::vector<PatchRange>& pending = {})
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    for (const UndoRange& u : journalled) {
+        QByteArray bytes(reinterpret_cast<const char*>(data + u.offset), u.original.size());
+        for (const PatchRange& r : pending) {
+            const qint64 begin = std::max(u.offset, r.offset);
+            const qint64 end = std::min(u.offset + u.original.size(), r.offset + r.bytes.size());
+            if (begin < end) {
+                memcpy(bytes.data() + (begin - u.offset), r.bytes.constData() + (begin - r.offset), end - begin);
+            }
+        }
+        hash.addData(bytes);
+    }
+    return hash.result();
+}
+
+// Parses `journal` and checks it still describes the mapped save: same size and mtime as the last
+// patch left, and every range still holding the patched bytes.
+bool journalMatches(const QByteArray& journal, const QFile& file, const uchar* data, std::vector<UndoRange>& ranges)
+{
+    ranges.clear();
+    if (journal.size() < UndoHeaderSize || !journal.startsWith(UndoMagic)) {
+        return false;
+    }
+    const char* header = journal.constData() + UndoMagic.size();
+    const qint64 size = file.size();
+    if (qFromLittleEndian<qint64>(header) != size
+        || qFromLittleEndian<qint64>(header + 8) != file.fileTime(QFileDevice::FileModificationTime).toMSecsSinceEpoch()) {
+        return false;
+    }
+    for (qint64 pos = UndoHeaderSize; pos < journal.size();) {
+        if (journal.size() - pos < 12) {
+            return false;
+        }
+        const qint64 offset = qFromLittleEndian<qint64>(journal.constData() + pos);
+        const quint32 length = qFromLittleEndian<quint32>(journal.constData() + pos + 8);
+        pos += 12;
+        if (length > journal.size() - pos || offset < 0 || offset > size - length) {
+            return false;
+        }
+        ranges.push_back({ offset, QByteArrayView(journal.constData() + pos, length) });
+        pos += length;
+    }
+    return patchedHash(data, ranges) == QByteArray::fromRawData(header + 16, 16);
+}
+
+QByteArray readJournal(const QString& path)
+{
+    QFile journalFile(undoPath(path));
+    return journalFile.open(QIODevice::ReadOnly) ? journalFile.readAll() : QByteArray();
+}
+
+}
 
 GameMapChanger::GameMapChanger(const Options &options)
     : options_(options)
@@ -9,112 +109,321 @@ GameMapChanger::GameMapChanger(const Options &options)
 
 bool GameMapChanger::copy(const QString& from, const QString& to, const std::vector<MineralData>& addMinerals)
 {
-    QFile toFile(to);
+    if (QFileInfo(to).absoluteFilePath() == QFileInfo(from).absoluteFilePath()) {
+        return false;
+    }
     QFile fromFile(from);
-    if (toFile.fileName() == fromFile.fileName()) {
-        return false;
-    }
-    if (!toFile.open(QIODevice::WriteOnly) || !fromFile.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-
-    QDataStream in(&fromFile);
-    in.setByteOrder(QDataStream::LittleEndian);
-    QDataStream out(&toFile);
-    out.setByteOrder(QDataStream::LittleEndian);
-
-    while(!in.atEnd()) {
-        quint8 componentType;
-        in >> componentType;
-        QByteArray field = readArray<quint8>(in);
-        uint fieldSize;
-        in >> fieldSize;
-        uint id = 0;
-        in >> id;
-        QByteArray buf(fieldSize - 4, Qt::Uninitialized);
-        in.readRawData(buf.data(), fieldSize - 4);
-
-        bool removeField = false;
-        switch (parseBaseType(id)) {
-        case BaseType::FoWSystem: {
-            if (options_.removeFoW) {
-                for (int i = 0; i < 512; ++i) {
-                    for (int j = 0; j < 512; ++j) {
-                        buf[(1 + i + j * 512) * 4 + 1] = 0xff;
-                        buf[(1 + i + j * 512) * 4 + 2] = 0xff;
-                    }
-                }
-            }
-            break;
+    if (!fromFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = fromFile.size();
+    const uchar* data = size > 0 ? fromFile.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return false;
+    }
+    // QSaveFile writes to a temporary file and only replaces `to` after a successful flush and sync.
+    QSaveFile toFile(to);
+    if (!toFile.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    // Records that are not edited are not decoded: consecutive runs of them are written straight
+    // from the mapping in one call, and only the edited fields are re-encoded.
+    qint64 unchangedBegin = 0;
+    auto writeUnchanged = [&](qint64 end) {
+        if (end > unchangedBegin) {
+            toFile.write(reinterpret_cast<const char*>(data + unchangedBegin), end - unchangedBegin);
+        }
+    };
+
+    bool valid = true;
+    forEachSaveRecord(QByteArrayView(data, size), [&](const SaveRecord& r) {
+        QByteArray buf;
+        const FieldEdit edit = editField(parseBaseType(r.id), QByteArrayView(data + r.fieldBegin, r.fieldSize), buf, addMinerals);
+        if (edit == FieldEdit::Keep || !valid) {
+            return;
+        }
+        if (edit == FieldEdit::Invalid) {
+            valid = false;
+            return;
         }
-        case BaseType::MetaData:
-            if (!options_.name.isEmpty() || options_.pacifist != 1) {
-                handleMetaData(buf);
+        writeUnchanged(r.begin);
+        unchangedBegin = r.fieldBegin + r.fieldSize;
+        if (edit == FieldEdit::Change) {
+            uchar sizeAndId[8];
+            qToLittleEndian<quint32>(buf.size() + 4, sizeAndId);
+            qToLittleEndian<quint32>(r.id, sizeAndId + 4);
+            toFile.write(reinterpret_cast<const char*>(data + r.begin), r.headerSize);
+            toFile.write(reinterpret_cast<const char*>(sizeAndId), sizeof(sizeAndId));
+            toFile.write(buf);
+        }
+    });
+    if (!valid) {
+        toFile.cancelWriting();
+        return false;
+    }
+    writeUnchanged(size);
+    return toFile.commit();
+}
+
+GameMapChanger::PatchResult GameMapChanger::patch(const QString& path, const std::vector<MineralData>& addMinerals)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite)) {
+        return PatchResult::Failed;
+    }
+    const qint64 size = file.size();
+    uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return PatchResult::Failed;
+    }
+
+    // Collect the differing byte ranges of every edited field; any edit that would move bytes makes
+    // the whole patch impossible, and nothing is written.
+    std::vector<PatchRange> ranges;
+    bool sizePreserved = true;
+    forEachSaveRecord(QByteArrayView(data, size), [&](const SaveRecord& r) {
+        QByteArray buf;
+        const QByteArrayView field(data + r.fieldBegin, r.fieldSize);
+        const FieldEdit edit = editField(parseBaseType(r.id), field, buf, addMinerals);
+        if (edit == FieldEdit::Keep) {
+            return;
+        }
+        if (edit == FieldEdit::Invalid || edit == FieldEdit::Remove || buf.size() != field.size()) {
+            sizePreserved = false;
+            return;
+        }
+        const char* edited = buf.constData();
+        const char* original = field.data();
+        qint64 i = 0;
+        while (i < buf.size()) {
+            if (edited[i] == original[i]) {
+                ++i;
+                continue;
             }
-            break;
-        case BaseType::BuildingBuildSite:
-            removeField = options_.removeBuildingSites;
-            break;
-        case BaseType::MineralManager: {
-            if (!addMinerals.empty() || options_.doubleMinerals) {
-                handleMinerals(buf, addMinerals);
+            qint64 end = i + 1;
+            for (qint64 same = 0; end < buf.size() && same < PatchGap; ++end) {
+                same = edited[end] == original[end] ? same + 1 : 0;
             }
-            break;
-        }
+            while (edited[end - 1] == original[end - 1]) {
+                --end;
+            }
+            ranges.push_back({ r.fieldBegin + i, buf.sliced(i, end - i) });
+            i = end;
         }
-        if (!removeField) {
-            fieldSize = buf.size() + 4;
+    });
+    if (!sizePreserved) {
+        return PatchResult::NeedsCopy;
+    }
+    if (ranges.empty()) {
+        return PatchResult::Patched;
+    }
 
-            out << componentType;
-            out << quint8(field.size());
-            out.writeRawData(field.data(), field.size());
-            out << fieldSize;
-            out << id;
-            out.writeRawData(buf.data(), buf.size());
+    // The journal keeps the original bytes of each range and is synced before the save is touched.
+    // One left from an earlier version of the save is started afresh.
+    QByteArray journal = readJournal(path);
+    std::vector<UndoRange> undoRanges;
+    if (!journalMatches(journal, file, data, undoRanges)) {
+        journal = UndoMagic;
+        journal.resize(UndoHeaderSize);
+    }
+    for (const PatchRange& range : ranges) {
+        uchar header[12];
+        qToLittleEndian<qint64>(range.offset, header);
+        qToLittleEndian<quint32>(range.bytes.size(), header + 8);
+        journal.append(reinterpret_cast<const char*>(header), sizeof(header));
+        journal.append(reinterpret_cast<const char*>(data + range.offset), range.bytes.size());
+    }
+    // The ranges are parsed again, as appending may have moved the journal.
+    undoRanges.clear();
+    for (qint64 pos = UndoHeaderSize; pos < journal.size();) {
+        const quint32 length = qFromLittleEndian<quint32>(journal.constData() + pos + 8);
+        undoRanges.push_back({ qFromLittleEndian<qint64>(journal.constData() + pos), QByteArrayView(journal.constData() + pos + 12, length) });
+        pos += 12 + length;
+    }
+    const QDateTime patched = QDateTime::fromMSecsSinceEpoch(QDateTime::currentMSecsSinceEpoch());
+    char* header = journal.data() + UndoMagic.size();
+    qToLittleEndian<qint64>(size, header);
+    qToLittleEndian<qint64>(patched.toMSecsSinceEpoch(), header + 8);
+    memcpy(header + 16, patchedHash(data, undoRanges, ranges).constData(), 16);
+    QSaveFile journalFile(undoPath(path));
+    if (!journalFile.open(QIODevice::WriteOnly)) {
+        return PatchResult::Failed;
+    }
+    journalFile.write(journal);
+    if (!journalFile.commit()) {
+        return PatchResult::Failed;
+    }
+
+    for (const PatchRange& range : ranges) {
+        memcpy(data + range.offset, range.bytes.constData(), range.bytes.size());
+    }
+    // Writes through a mapping don't reliably touch the mtime, which snapshot caches are keyed on.
+    if (!file.unmap(data) || !file.setFileTime(patched, QFileDevice::FileModificationTime)) {
+        return PatchResult::Failed;
+    }
+    return PatchResult::Patched;
+}
+
+bool GameMapChanger::rollback(const QString& path)
+{
+    const QByteArray journal = readJournal(path);
+    if (journal.isEmpty()) {
+        return false;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return false;
+    }
+    std::vector<UndoRange> ranges;
+    if (!journalMatches(journal, file, data, ranges)) {
+        file.unmap(data);
+        QFile::remove(undoPath(path));
+        return false;
+    }
+    // Later patches may overlap earlier ones, so they are undone newest first.
+    for (auto i = ranges.rbegin(); i != ranges.rend(); ++i) {
+        memcpy(data + i->offset, i->original.data(), i->original.size());
+    }
+    if (!file.unmap(data) || !file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime)) {
+        return false;
+    }
+    file.close();
+    return QFile::remove(undoPath(path));
+}
+
+bool GameMapChanger::canRollback(const QString& path)
+{
+    const QByteArray journal = readJournal(path);
+    if (journal.isEmpty()) {
+        return false;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    const uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return false;
+    }
+    // A journal the save no longer matches is left for rollback() or patch() to remove.
+    std::vector<UndoRange> ranges;
+    return journalMatches(journal, file, data, ranges);
+}
+
+GameMapChanger::FieldEdit GameMapChanger::editField(BaseType type, QByteArrayView field, QByteArray& buf, const std::vector<MineralData>& addMinerals)
+{
+    switch (type) {
+    case BaseType::FoWSystem:
+        if (options_.removeFoW || !options_.revealRects.empty() || !options_.revealAreas.empty()) {
+            buf = field.toByteArray();
+            handleFoW(buf);
+            return FieldEdit::Change;
+        }
+        break;
+    case BaseType::MetaData:
+        if (!options_.name.isEmpty() || options_.pacifist != 1) {
+            buf = field.toByteArray();
+            return handleMetaData(buf) ? FieldEdit::Change : FieldEdit::Invalid;
         }
+        break;
+    case BaseType::BuildingBuildSite:
+        if (options_.removeBuildingSites) {
+            return FieldEdit::Remove;
+        }
+        break;
+    case BaseType::MineralManager:
+        if (!addMinerals.empty() || options_.doubleMinerals) {
+            buf = field.toByteArray();
+            return handleMinerals(buf, addMinerals) ? FieldEdit::Change : FieldEdit::Invalid;
+        }
+        break;
     }
-    return true;
+    return FieldEdit::Keep;
+}
 
+void GameMapChanger::handleFoW(QByteArray& buf)
+{
+    // A 4-byte header followed by a square grid of 4-byte cells, row by row along z.
+    constexpr qsizetype HeaderSize = 4;
+    const qsizetype cellCount = (buf.size() - HeaderSize) / 4;
+    if (cellCount <= 0) {
+        return;
+    }
+    qsizetype size = qsizetype(std::sqrt(double(cellCount)));
+    while (size * size > cellCount) {
+        --size;
+    }
+    while ((size + 1) * (size + 1) <= cellCount) {
+        ++size;
+    }
+    uchar* cells = reinterpret_cast<uchar*>(buf.data()) + HeaderSize;
+    if (options_.removeFoW) {
+        revealCells(cells, size * size);
+        return;
+    }
+
+    auto revealRow = [&](qsizetype z, qreal left, qreal right) {
+        const qsizetype first = std::max<qsizetype>(0, qsizetype(std::floor(left)));
+        const qsizetype last = std::min<qsizetype>(size, qsizetype(std::ceil(right)));
+        if (z >= 0 && z < size && first < last) {
+            revealCells(cells + (z * size + first) * 4, last - first);
+        }
+    };
+    for (const RevealArea& a : options_.revealAreas) {
+        const qreal cx = a.center.x() * size;
+        const qreal cz = a.center.y() * size;
+        const qreal rx = a.radius.width() * size;
+        const qreal rz = a.radius.height() * size;
+        if (rx <= 0 || rz <= 0) {
+            continue;
+        }
+        const qsizetype bottom = qsizetype(std::ceil(cz + rz));
+        for (qsizetype z = qsizetype(std::floor(cz - rz)); z <= bottom; ++z) {
+            const qreal dz = (z + 0.5 - cz) / rz;
+            if (std::abs(dz) > 1) {
+                continue;
+            }
+            const qreal halfWidth = rx * std::sqrt(1 - dz * dz);
+            revealRow(z, cx - halfWidth, cx + halfWidth);
+        }
+    }
 }
 
-void GameMapChanger::handleMinerals(QByteArray& buf, const std::vector<MineralData> &addMinerals)
+bool GameMapChanger::handleMinerals(QByteArray& buf, const std::vector<MineralData> &addMinerals)
 {
-    QBuffer outBuf;
-    outBuf.open(QIODeviceBase::WriteOnly);
-    QDataStream fout(&outBuf);
-    QDataStream fin(&buf, QIODeviceBase::ReadOnly);
-    fout.setByteOrder(QDataStream::LittleEndian);
-    fout.setFloatingPointPrecision(QDataStream::SinglePrecision);
-    fin.setByteOrder(QDataStream::LittleEndian);
-    fin.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    ByteCursor in(buf);
+    QByteArray out;
+    out.reserve(buf.size() + qsizetype(addMinerals.size()) * 45);
 
-    QByteArray tmp(1, Qt::Uninitialized);
-    fin.readRawData(tmp.data(), 1);
-    fout.writeRawData(tmp.data(), 1);
+    out.append(in.readBytes(1));
 
     auto hanleMineral = [&](std::set<MineralType> types, uint dataSize) -> uint {
-        uint count;
-        fin >> count;
+        const quint32 count = in.read<quint32>("mineral count");
+        if (!in.expect(count, dataSize + 5, "minerals")) {
+            return 0;
+        }
         uint adding = 0;
         for (const auto& m : addMinerals) {
             if (types.count(m.type) != 0) {
                 ++adding;
             }
         }
-        fout << uint(count + adding);
+        appendLittleEndian<quint32>(out, count + adding);
         for (uint i = 0; i < count; ++i) {
-            tmp.resize(dataSize);
-            fin.readRawData(tmp.data(), tmp.size());
-            fout.writeRawData(tmp.data(), tmp.size());
-            uint amount;
-            fin >> amount;
+            out.append(in.readBytes(dataSize));
+            quint32 amount = in.read<quint32>();
             if (options_.doubleMinerals) {
                 amount *= 2;
             }
-            fout << amount;
-            uchar deep;
-            fin >> deep;
-            fout << deep;
+            appendLittleEndian(out, amount);
+            appendLittleEndian(out, in.read<quint8>());
         }
         return count;
     };
@@ -124,90 +433,70 @@ void GameMapChanger::handleMinerals(QByteArray& buf, const std::vector<MineralDa
         hanleMineral({mineralType}, 16);
         for (const auto& m : addMinerals) {
             if (m.type == mineralType) {
-                fout << m.p;
-                fout << m.r;
-                fout << m.amount;
-                fout << m.deep;
+                appendLittleEndian(out, m.p);
+                appendLittleEndian(out, m.r);
+                appendLittleEndian<quint32>(out, m.amount);
+                appendLittleEndian<quint8>(out, m.deep);
             }
         }
     }
     uint mineralIndex = hanleMineral({MineralType::Gold, MineralType::Coal, MineralType::Iron}, 24);
     for (const auto& m : addMinerals) {
         if (m.type == MineralType::Gold || m.type == MineralType::Coal || m.type == MineralType::Iron) {
-            fout << ++mineralIndex;
-            fout << mineralTypeId(m.type);
-            fout << m.p;
-            fout << m.r;
-            fout << m.amount;
-            fout << m.deep;
-        }
-    }
-    quint32 count;
-    fin >> count;
-    tmp.resize(count * 32 + 1);
-    fin.readRawData(tmp.data(), tmp.size());
-    fout << count;
-    fout.writeRawData(tmp.data(), tmp.size());
-
-    quint32 mineralCount;
-    fin >> mineralCount;
-    tmp.resize(mineralCount * 20);
-    fin.readRawData(tmp.data(), tmp.size());
+            appendLittleEndian<quint32>(out, ++mineralIndex);
+            appendLittleEndian<quint32>(out, mineralTypeId(m.type));
+            appendLittleEndian(out, m.p);
+            appendLittleEndian(out, m.r);
+            appendLittleEndian<quint32>(out, m.amount);
+            appendLittleEndian<quint8>(out, m.deep);
+        }
+    }
+    const quint32 count = in.read<quint32>("deposit count");
+    in.expect(count, 32, "deposits");
+    appendLittleEndian(out, count);
+    out.append(in.readBytes(qsizetype(count) * 32 + 1));
+
+    quint32 mineralCount = in.read<quint32>("mineral count");
+    in.expect(mineralCount, 20, "mineral positions");
+    const QByteArrayView positions = in.readBytes(qsizetype(mineralCount) * 20);
     for (const auto& m : addMinerals) {
         if (m.type == MineralType::Gold || m.type == MineralType::Coal || m.type == MineralType::Iron) {
             ++mineralCount;
         }
     }
-    fout << mineralCount;
-    fout.writeRawData(tmp.data(), tmp.size());
+    appendLittleEndian(out, mineralCount);
+    out.append(positions);
     for (const auto& m : addMinerals) {
         if (m.type == MineralType::Gold || m.type == MineralType::Coal || m.type == MineralType::Iron) {
-            fout << mineralTypeId(m.type);
-            fout << m.p;
+            appendLittleEndian<quint32>(out, mineralTypeId(m.type));
+            appendLittleEndian(out, m.p);
         }
     }
-    tmp.resize(1);
-    fin.readRawData(tmp.data(), 1);
-    fout.writeRawData(tmp.data(), 1);
+    out.append(in.readBytes(1));
 
-    buf = outBuf.data();
+    if (!in.ok()) {
+        return false;
+    }
+    buf = out;
+    return true;
 }
 
-void GameMapChanger::handleMetaData(QByteArray& buf)
-{
-    QBuffer outBuf;
-    outBuf.open(QIODeviceBase::WriteOnly);
-    QDataStream fout(&outBuf);
-    QDataStream fin(&buf, QIODeviceBase::ReadOnly);
-    fout.setByteOrder(QDataStream::LittleEndian);
-    fin.setByteOrder(QDataStream::LittleEndian);
-
-    uint readed = 5;
-    QByteArray tmp(5, Qt::Uninitialized);
-    fin.readRawData(tmp.data(), tmp.size());
-    fout.writeRawData(tmp.data(), tmp.size());
-
-    quint8 len;
-    fin >> len;
-    tmp.resize(len);
-    fin.readRawData(tmp.data(), tmp.size());
-    fout << len;
-    fout.writeRawData(tmp.data(), tmp.size());
-    readed += len + 1;
-
-    fin >> len;
-    tmp.resize(len);
-    fin.readRawData(tmp.data(), tmp.size());
-    fout << len;
-    fout.writeRawData(tmp.data(), tmp.size());
-    readed += len + 1;
-
-    tmp.resize(4);
-    fin.readRawData(tmp.data(), 4);
-    fout.writeRawData(tmp.data(), 4);
-
-    quint8 pacifist;
-    fin >> pacifist;
+bool GameMapChanger::handleMetaData(QByteArray& buf)
+{
+    ByteCursor in(buf);
+    QByteArray out;
+    out.reserve(buf.size() + options_.name.size());
+
+    out.append(in.readBytes(5));
+    // version and seed
+    for (const char* what : { "version", "seed" }) {
+        const QByteArrayView v = in.readArray<quint8>(what);
+        appendLittleEndian<quint8>(out, v.size());
+        out.append(v);
+    }
+    out.append(in.readBytes(4));
+
+    quint8 pacifist = in.read<quint8>("pacifist");
     switch (options_.pacifist)
     {
     case 0:
@@ -220,18 +509,18 @@ void GameMapChanger::handleMetaData(QByteArray& buf)
         pacifist = 1;
         break;
     }
-    fout << pacifist;
-    readed += 5;
+    appendLittleEndian(out, pacifist);
 
     if (!options_.name.isEmpty()) {
-        fin >> len;
-        tmp.resize(len);
-        fin.readRawData(tmp.data(), tmp.size());
-        fout << quint8(options_.name.size());
-        fout.writeRawData(options_.name.data(), options_.name.size());
-        readed += len + 1;
+        in.readArray<quint8>("name");
+        appendLittleEndian<quint8>(out, options_.name.size());
+        out.append(options_.name);
     }
 
-    fout.writeRawData(buf.data() + readed, buf.size() - readed);
-    buf = outBuf.data();
+    if (!in.ok()) {
+        return false;
+    }
+    out.append(in.readBytes(in.remaining()));
+    buf = out;
+    return true;
 }
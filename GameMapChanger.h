@@ -9,26 +9,63 @@ class GameMapChanger
 {
 
 public:
+    // Ellipse to reveal, with the center and the x and z radii normalized to the map size, so a
+    // circle in world units stays round on maps that aren't square.
+    struct RevealArea
+    {
+        QPointF center;
+        QSizeF radius;
+    };
+
     struct Options
     {
         bool removeFoW = false;
+        std::vector<RevealArea> revealAreas;
         bool removeBuildingSites = false;
         bool doubleMinerals = false;
         QByteArray name;
         int pacifist = 1;
     };
 
+    enum class PatchResult
+    {
+        Patched,
+        // An edit changes the size of a field, e.g. added minerals; nothing was written.
+        NeedsCopy,
+        Failed
+    };
+
     explicit GameMapChanger(const Options& options);
 
     bool copy(const QString& from, const QString& to, const std::vector<MineralData>& addMinerals);
+    // Edits `path` in place when no edited field changes size, journalling the overwritten bytes to
+    // `path` + ".undo" first. Leaves the save untouched if the edits need a copy().
+    PatchResult patch(const QString& path, const std::vector<MineralData>& addMinerals);
+    // Restores every range recorded by patch() and removes the journal. A journal the save has
+    // changed under since the last patch is removed without restoring anything.
+    static bool rollback(const QString& path);
+    // Whether `path` has a journal that still matches it. Never changes anything.
+    static bool canRollback(const QString& path);
 
 signals:
 
 private:
+    enum class FieldEdit
+    {
+        Keep,
+        Change,
+        Remove,
+        // The field could not be parsed; nothing is written.
+        Invalid
+    };
+
     Options options_;
 
-    void handleMinerals(QByteArray& buf, const std::vector<MineralData>& addMinerals);
-    void handleMetaData(QByteArray& buf);
+    FieldEdit editField(BaseType type, QByteArrayView field, QByteArray& buf, const std::vector<MineralData>& addMinerals);
+
+    void handleFoW(QByteArray& buf);
+    bool handleMinerals(QByteArray& buf, const std::vector<MineralData>& addMinerals);
+    bool handleMetaData(QByteArray& buf);
 };
 
 #endif // GAMEMAPCHANGER_H
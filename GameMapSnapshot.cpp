@@ -0,0 +1,141 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "GameMapSnapshot.h"
+#include "GameMap.h"
+
+namespace {
+
+std::atomic<quint64> lastRevision{ 0 };
+
+// Decodes one part with a reader of its own, so parts decode in parallel, and keeps where it ran
+// past the end of its field.
+template<class Member, class Read>
+QFuture<void> decodePart(GameMap& map, const QSharedPointer<GameMapSnapshot>& r, GameMapSnapshot::Part part, Member member,
+                         Read read)
+{
+    return QtConcurrent::run([&map, r, part, member, read]() {
+        auto reader = map.reader();
+        r.data()->*member = (reader.*read)();
+        const GameMap::SaveReader::ParseError& e = reader.lastError();
+        if (e.error.offset >= 0) {
+            r->errors[part] = e.toString();
+        }
+    });
+}
+
+}
+
+GameMapSnapshot::GameMapSnapshot()
+{
+    for (quint64& revision : revisions) {
+        revision = ++lastRevision;
+    }
+}
+
+bool GameMapSnapshot::hasErrors() const
+{
+    return std::any_of(std::begin(errors), std::end(errors), [](const QString& e) {
+        return !e.isEmpty();
+    });
+}
+
+QSharedPointer<const GameMapSnapshot> GameMapSnapshot::create(GameMap& map)
+{
+    auto r = QSharedPointer<GameMapSnapshot>::create();
+    // Every reader wraps its own buffer around the shared mapping, so fields can be decoded in parallel.
+    QList<QFuture<void>> jobs;
+    jobs << decodePart(map, r, Agriculture, &GameMapSnapshot::agricultureData, &GameMap::SaveReader::agricultureData);
+    jobs << decodePart(map, r, Forageables, &GameMapSnapshot::forageables, &GameMap::SaveReader::forageables);
+    jobs << decodePart(map, r, Minerals, &GameMapSnapshot::minerals, &GameMap::SaveReader::minerals);
+    jobs << decodePart(map, r, Raiders, &GameMapSnapshot::raiders, &GameMap::SaveReader::raiders);
+    jobs << decodePart(map, r, Animals, &GameMapSnapshot::animals, &GameMap::SaveReader::animals);
+    jobs << decodePart(map, r, Houses, &GameMapSnapshot::houses, &GameMap::SaveReader::houses);
+    jobs << decodePart(map, r, AnimalSpawns, &GameMapSnapshot::animalsSpawns, &GameMap::SaveReader::animalsSpawns);
+    jobs << decodePart(map, r, General, &GameMapSnapshot::generalSaveData, &GameMap::SaveReader::generalSaveData);
+    jobs << decodePart(map, r, Camera, &GameMapSnapshot::camera, &GameMap::SaveReader::camera);
+    for (auto& job : jobs) {
+        job.waitForFinished();
+    }
+    r->index.build(*r);
+    return r;
+}
+
+QSharedPointer<const GameMapSnapshot> GameMapSnapshot::update(GameMap& map, GameMap& previous)
+{
+    const QSharedPointer<const GameMapSnapshot> old = previous.snapshot();
+    const QHash<BaseType, quint64>& hashes = map.fieldHashes();
+    const QHash<BaseType, quint64>& oldHashes = previous.fieldHashes();
+    auto r = QSharedPointer<GameMapSnapshot>::create();
+    bool same[PartCount];
+    for (int i = 0; i < PartCount; ++i) {
+        same[i] = true;
+        for (BaseType type : sourceFields(Part(i))) {
+            same[i] = same[i] && hashes.value(type) == oldHashes.value(type);
+        }
+    }
+
+    QList<QFuture<void>> jobs;
+    auto part = [&](Part p, auto member, auto read) {
+        if (same[p]) {
+            r.data()->*member = old.data()->*member;
+            r->revisions[p] = old->revisions[p];
+            r->errors[p] = old->errors[p];
+            return;
+        }
+        jobs << decodePart(map, r, p, member, read);
+    };
+    part(Agriculture, &GameMapSnapshot::agricultureData, &GameMap::SaveReader::agricultureData);
+    part(Forageables, &GameMapSnapshot::forageables, &GameMap::SaveReader::forageables);
+    part(Minerals, &GameMapSnapshot::minerals, &GameMap::SaveReader::minerals);
+    part(Raiders, &GameMapSnapshot::raiders, &GameMap::SaveReader::raiders);
+    part(Animals, &GameMapSnapshot::animals, &GameMap::SaveReader::animals);
+    part(Houses, &GameMapSnapshot::houses, &GameMap::SaveReader::houses);
+    part(AnimalSpawns, &GameMapSnapshot::animalsSpawns, &GameMap::SaveReader::animalsSpawns);
+    part(General, &GameMapSnapshot::generalSaveData, &GameMap::SaveReader::generalSaveData);
+    part(Camera, &GameMapSnapshot::camera, &GameMap::SaveReader::camera);
+    for (auto& job : jobs) {
+        job.waitForFinished();
+    }
+    if (same[Minerals] && same[Forageables] && same[Raiders] && same[Animals] && same[Houses]) {
+        r->index = old->index;
+    } else {
+        r->index.build(*r);
+    }
+    return r;
+}
+
+QList<BaseType> GameMapSnapshot::sourceFields(Part part)
+{
+    switch (part) {
+    case General:
+        return { BaseType::MetaData };
+    case Camera:
+        return { BaseType::CameraManager };
+    case Agriculture:
+        return { BaseType::AgricultureManager };
+    case Forageables:
+        return { BaseType::ForageableResource };
+    case Minerals:
+        return { BaseType::MineralManager };
+    case Raiders:
+        return { BaseType::Raider, BaseType::BatteringRam };
+    case Animals:
+        return { BaseType::Deer, BaseType::Bear, BaseType::Boar, BaseType::Wolf, BaseType::WolfDen };
+    case Houses:
+        return { BaseType::TownCenter, BaseType::Shelter };
+    case AnimalSpawns:
+        return { BaseType::AnimalManager };
+    case PartCount:
+        break;
+    }
+    return {};
+}
@@ -0,0 +1,66 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef GAMEMAPSNAPSHOT_H
+#define GAMEMAPSNAPSHOT_H
+
+#include "DataDefines.h"
+#include "SpatialIndex.h"
+
+class GameMap;
+
+// Everything the UI shows for a save, decoded once. A snapshot is never modified after create(),
+// so it can be shared between threads without locking.
+struct GameMapSnapshot
+{
+    // The members below that are decoded from their own save fields.
+    enum Part
+    {
+        General,
+        Camera,
+        Agriculture,
+        Forageables,
+        Minerals,
+        Raiders,
+        Animals,
+        Houses,
+        AnimalSpawns,
+        PartCount
+    };
+
+    GameMapSnapshot();
+
+    GeneralSaveData generalSaveData;
+    Point camera = {};
+    std::vector<MineralData> minerals;
+    std::vector<ForageableData> forageables;
+    std::vector<RaiderData> raiders;
+    std::vector<BaseData> animals;
+    std::vector<BaseData> houses;
+    std::vector<AnimalSpawnData> animalsSpawns;
+    AgricultureInfo::Data agricultureData;
+    // Minerals, forageables, animals, raiders and houses by position.
+    SpatialIndex index;
+    // Equal revisions of a part in two snapshots mean equal contents; a new snapshot gets new ones.
+    quint64 revisions[PartCount];
+    // Where decoding a part ran out of data, leaving it short or empty; empty if it didn't.
+    QString errors[PartCount];
+
+    bool hasErrors() const;
+
+    static QSharedPointer<const GameMapSnapshot> create(GameMap& map);
+    // Like create(), but copies each part from the snapshot of `previous` whose save fields have
+    // the same hashes in both maps, with its revision, and decodes only the rest.
+    static QSharedPointer<const GameMapSnapshot> update(GameMap& map, GameMap& previous);
+    // The save fields a part is decoded from.
+    static QList<BaseType> sourceFields(Part part);
+};
+
+#endif // GAMEMAPSNAPSHOT_H
@@ -0,0 +1,93 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "MapInspector.h"
+#include "GameMapSnapshot.h"
+#include "MapRenderer.h"
+#include "ParseData.h"
+
+namespace {
+
+// Entities listed per kind; the nearest ones win.
+constexpr size_t MaxListed = 5;
+
+// In AgricultureInfo::DataType order.
+const QLatin1String AgricultureNames[AgricultureInfo::Max] = {
+    QLatin1String("Env. fertility"), QLatin1String("Fertility"), QLatin1String("Honey"), QLatin1String("Original honey"),
+    QLatin1String("Fodder"), QLatin1String("Original fodder"), QLatin1String("Water"), QLatin1String("Original water"),
+    QLatin1String("Clay/sand"), QLatin1String("Tree growth")
+};
+
+}
+
+QString inspectMapPoint(const GameMapSnapshot& snapshot, const HeightMap* heightMap, const QPointF& world, float radius)
+{
+    QString r = QString("x: %1 z: %2").arg(qRound(world.x())).arg(qRound(world.y()));
+    if (heightMap && !heightMap->isEmpty()) {
+        r += QString("\nheight: %1").arg(heightMap->sample(world.x(), world.y()), 0, 'f', 1);
+    }
+
+    // Nearest first, at most MaxListed per kind.
+    struct Hit
+    {
+        float distance;
+        EntityRef ref;
+    };
+    std::vector<Hit> hits;
+    const QRectF rect(world.x() - radius, world.y() - radius, radius * 2, radius * 2);
+    snapshot.index.forEachInRect(rect, SpatialIndex::AllKinds, [&](EntityRef e, float x, float z) {
+        const float d = std::hypot(x - float(world.x()), z - float(world.y()));
+        if (d <= radius) {
+            hits.push_back({ d, e });
+        }
+    });
+    std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) { return a.distance < b.distance; });
+    size_t listed[size_t(EntityKind::Count)] = {};
+    for (const Hit& h : hits) {
+        if (listed[size_t(h.ref.kind)]++ >= MaxListed) {
+            continue;
+        }
+        switch (h.ref.kind) {
+        case EntityKind::Mineral: {
+            const MineralData& m = snapshot.minerals[h.ref.index];
+            r += QString("\n%1: %2").arg(mineralStr(m.type), m.deep ? QString("∞ (deep)") : QString::number(m.amount));
+            break;
+        }
+        case EntityKind::Forageable: {
+            const ForageableData& m = snapshot.forageables[h.ref.index];
+            r += QString("\n%1: %2").arg(itemStr(m.type)).arg(m.amount);
+            break;
+        }
+        case EntityKind::Animal:
+        case EntityKind::House: {
+            const BaseData& m = h.ref.kind == EntityKind::Animal ? snapshot.animals[h.ref.index] : snapshot.houses[h.ref.index];
+            r += QString("\n%1").arg(baseStr(m.type));
+            break;
+        }
+        case EntityKind::Raider: {
+            const RaiderData& m = snapshot.raiders[h.ref.index];
+            r += QString("\n%1, hp %2").arg(raiderStr(m.type)).arg(m.hp, 0, 'f', 0);
+            break;
+        }
+        case EntityKind::Count:
+            break;
+        }
+    }
+
+    const AgricultureInfo::Data& data = snapshot.agricultureData;
+    const QPoint cell = agricultureCellAt(world.x(), world.y());
+    if (!data.isEmpty() && cell.x() >= 0 && cell.y() >= 0 && uint(cell.x()) < data.width() && uint(cell.y()) < data.height()) {
+        for (uint t = 0; t < AgricultureInfo::Max; ++t) {
+            r += QString("\n%1: %2").arg(AgricultureNames[t]).arg(data.value(AgricultureInfo::DataType(t), cell.x(), cell.y()), 0, 'f', 2);
+        }
+    }
+    return r;
+}
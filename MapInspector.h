@@ -0,0 +1,25 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef MAPINSPECTOR_H
+#define MAPINSPECTOR_H
+
+#include <QPointF>
+#include <QString>
+
+struct GameMapSnapshot;
+struct HeightMap;
+
+// Describes what is at world (x, z): the entities within `radius` from the spatial index, the
+// agriculture cell drawn there and the terrain height. Reads only decoded data, so it is cheap
+// enough to call on every mouse move. `heightMap` may be null.
+QString inspectMapPoint(const GameMapSnapshot& snapshot, const HeightMap* heightMap, const QPointF& world, float radius);
+
+#endif // MAPINSPECTOR_H
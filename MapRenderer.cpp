@@ -0,0 +1,1150 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "MapRenderer.h"
+#include "GameMapSnapshot.h"
+
+// Where the amount label of each shown mineral goes at one scale, placed once so that every band
+// and tile agrees.
+struct MineralLabelLayout
+{
+    struct Label
+    {
+        uint mineral;
+        QRect rect;
+    };
+    // In drawing order.
+    std::vector<Label> labels;
+};
+
+// Every marker style rasterized once for a scale, so drawing a marker is a single blit without pen
+// or brush changes. A sprite is anchored at the pixel nearest its entity's position,
+// within half a pixel of where the per-entity drawing put it.
+struct SpriteAtlas
+{
+    enum Sprite
+    {
+        None = -1,
+        Wolf,
+        WolfDen,
+        Bear,
+        Deer,
+        Boar,
+        RaiderCross,
+        Raider,
+        BatteringRam,
+        Shelter,
+        TownCenter,
+        Camera,
+        // One per MineralType, then three sizes of each of Greens, Herbs, Willow and Roots.
+        MineralFirst,
+        ForageableFirst = MineralFirst + int(MineralType::Unknown) + 1,
+        SpriteCount = ForageableFirst + 4 * 3
+    };
+
+    explicit SpriteAtlas(float scale);
+
+    static Sprite mineral(MineralType type) { return Sprite(MineralFirst + int(type)); }
+    static Sprite forageable(GameItem type, uint amount);
+    static Sprite animal(BaseType type);
+
+    void draw(QPainter& p, Sprite sprite, const QPoint& anchor) const
+    {
+        p.drawImage(anchor + offset_[sprite], image_, source_[sprite]);
+    }
+
+private:
+    QImage image_;
+    QRect source_[SpriteCount];
+    QPoint offset_[SpriteCount];
+};
+
+SpriteAtlas::SpriteAtlas(float scale)
+{
+    constexpr float cellSize = 5;
+    // Each style as drawLayer used to draw it per entity, around an anchor at (0, 0), and the
+    // pixels it covers.
+    std::function<void(QPainter&)> styles[SpriteCount];
+    QRect bounds[SpriteCount];
+    auto cross = [](QPainter& p, const QColor& color, int ls) {
+        p.setPen(color);
+        p.drawLine(0, -ls, 0, ls);
+        p.drawLine(-ls, 0, ls, 0);
+    };
+    auto disc = [](QPainter& p, const QColor& pen, const QColor& brush, int r) {
+        p.setPen(pen);
+        p.setBrush(brush);
+        p.drawEllipse(-r, -r, r * 2, r * 2);
+    };
+    auto animal = [&](Sprite s, const QColor& crossColor, const QColor& borderColor, const QColor& circleColor, int ls, int r) {
+        styles[s] = [=](QPainter& p) {
+            cross(p, crossColor, ls);
+            disc(p, borderColor, circleColor, r);
+        };
+        bounds[s] = QRect(-ls, -ls, ls * 2 + 1, ls * 2 + 1);
+    };
+    animal(Wolf, Qt::red, Qt::darkMagenta, Qt::darkMagenta, 5, 3);
+    animal(WolfDen, Qt::black, Qt::black, Qt::darkMagenta, 5, 3);
+    animal(Bear, Qt::red, Qt::red, Qt::red, 5, 3);
+    animal(Deer, Qt::green, Qt::green, QColor(128, 216, 0), 4, 2);
+    animal(Boar, Qt::green, Qt::green, QColor(255, 216, 0), 4, 2);
+
+    styles[RaiderCross] = [=](QPainter& p) {
+        cross(p, Qt::magenta, 5);
+    };
+    bounds[RaiderCross] = QRect(-5, -5, 11, 11);
+    // Raider discs grow with the scale, as they always did.
+    constexpr int r = 3;
+    constexpr int inner = 2;
+    const int size = int(r * scale);
+    const int innerSize = int(inner * scale);
+    styles[Raider] = [=](QPainter& p) {
+        p.setPen(Qt::black);
+        p.setBrush(Qt::black);
+        p.drawEllipse(-r, -r, size, size);
+    };
+    bounds[Raider] = QRect(-r, -r, size + 1, size + 1);
+    styles[BatteringRam] = [=](QPainter& p) {
+        p.setPen(Qt::black);
+        p.setBrush(Qt::black);
+        p.drawEllipse(-r, -r, size, size);
+        p.setPen(Qt::magenta);
+        p.drawEllipse(-r, -inner, innerSize, innerSize);
+    };
+    bounds[BatteringRam] = bounds[Raider] | QRect(-r, -inner, innerSize + 1, innerSize + 1);
+
+    auto house = [&](Sprite s, float cells) {
+        const int ls = int(cells * cellSize / scale);
+        styles[s] = [=](QPainter& p) {
+            p.setPen(Qt::blue);
+            p.setBrush(Qt::blue);
+            p.drawRect(-ls, -ls, ls, ls);
+        };
+        bounds[s] = QRect(-ls, -ls, ls + 1, ls + 1);
+    };
+    house(Shelter, 3);
+    house(TownCenter, 5);
+
+    styles[Camera] = [=](QPainter& p) {
+        cross(p, Qt::blue, 5);
+    };
+    bounds[Camera] = QRect(-5, -5, 11, 11);
+
+    for (int t = 0; t <= int(MineralType::Unknown); ++t) {
+        const QColor c = mineralColor(MineralType(t));
+        styles[MineralFirst + t] = [=](QPainter& p) {
+            disc(p, c, c, 10);
+        };
+        bounds[MineralFirst + t] = QRect(-10, -10, 21, 21);
+    }
+    const GameItem items[4] = { GameItem::Greens, GameItem::Herbs, GameItem::Willow, GameItem::Roots };
+    for (int t = 0; t < 4; ++t) {
+        for (int size = 0; size < 3; ++size) {
+            const QColor c = itemColor(items[t]);
+            const int radius = size + 2;
+            styles[ForageableFirst + t * 3 + size] = [=](QPainter& p) {
+                disc(p, Qt::black, c, radius);
+            };
+            bounds[ForageableFirst + t * 3 + size] = QRect(-radius, -radius, radius * 2 + 1, radius * 2 + 1);
+        }
+    }
+
+    // Side by side in one image, with a pixel to spare around each.
+    int width = 0;
+    int height = 1;
+    for (QRect& b : bounds) {
+        b.adjust(-1, -1, 1, 1);
+        width += b.width();
+        height = qMax(height, b.height());
+    }
+    image_ = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+    image_.fill(Qt::transparent);
+    QPainter p(&image_);
+    int x = 0;
+    for (int i = 0; i < SpriteCount; ++i) {
+        source_[i] = QRect(x, 0, bounds[i].width(), bounds[i].height());
+        offset_[i] = bounds[i].topLeft();
+        p.save();
+        p.setClipRect(source_[i]);
+        p.translate(x - bounds[i].left(), -bounds[i].top());
+        styles[i](p);
+        p.restore();
+        x += bounds[i].width();
+    }
+}
+
+SpriteAtlas::Sprite SpriteAtlas::forageable(GameItem type, uint amount)
+{
+    const int size = amount > 19 ? 2 : amount > 14 ? 1 : 0;
+    switch (type) {
+    case GameItem::Greens:
+        return Sprite(ForageableFirst + size);
+    case GameItem::Herbs:
+        return Sprite(ForageableFirst + 3 + size);
+    case GameItem::Willow:
+        return Sprite(ForageableFirst + 6 + size);
+    case GameItem::Roots:
+        return Sprite(ForageableFirst + 9 + size);
+    default:
+        break;
+    }
+    return None;
+}
+
+SpriteAtlas::Sprite SpriteAtlas::animal(BaseType type)
+{
+    switch (type) {
+    case BaseType::Wolf:
+        return Wolf;
+    case BaseType::WolfDen:
+        return WolfDen;
+    case BaseType::Bear:
+        return Bear;
+    case BaseType::Deer:
+        return Deer;
+    case BaseType::Boar:
+        return Boar;
+    default:
+        break;
+    }
+    return None;
+}
+
+namespace {
+
+bool checkMineralOption(MineralType v, const DrawOptions &opt)
+{
+    switch (v) {
+    case MineralType::Iron:
+        if (!opt.iron)
+            return false;
+        break;
+    case MineralType::Gold:
+        if (!opt.gold)
+            return false;
+        break;
+    case MineralType::Coal:
+        if (!opt.coal)
+            return false;
+        break;
+    case MineralType::Clay:
+        if (!opt.clay)
+            return false;
+        break;
+    case MineralType::Sand:
+        if (!opt.sand)
+            return false;
+        break;
+    case MineralType::Stone:
+        if (!opt.stone)
+            return false;
+        break;
+    }
+    return true;
+}
+
+struct OverlayLayer
+{
+    const quint8* levels;
+    quint8 limit;
+    quint32 color;
+};
+
+// Smallest q in 0..101 with !(v > q / 100.0f), so q > t exactly when v > t / 100.0f for t in 0..100.
+quint8 quantizeLevel(float v)
+{
+    int q = std::isnan(v) ? 0 : int(std::clamp(std::ceil(v * 100.0f), 0.0f, 101.0f));
+    while (q > 0 && !(v > (q - 1) / 100.0f)) {
+        --q;
+    }
+    while (q <= 100 && v > q / 100.0f) {
+        ++q;
+    }
+    return quint8(q);
+}
+
+// Colours `count` cells from the quantized levels of every layer. Later layers win; a cell under
+// every limit stays transparent.
+void rasterOverlayRow(const OverlayLayer* layers, uint layerCount, size_t offset, uint count, quint32* out)
+{
+    uint i = 0;
+#if FF_SIMD_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i c[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for (uint l = 0; l < layerCount; ++l) {
+            const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(layers[l].levels + offset + i));
+            // Levels are at most 101, so the signed compare is exact.
+            const __m128i m8 = _mm_cmpgt_epi8(q, _mm_set1_epi8(char(layers[l].limit)));
+            const __m128i lo = _mm_unpacklo_epi8(m8, m8);
+            const __m128i hi = _mm_unpackhi_epi8(m8, m8);
+            const __m128i m[4] = { _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo), _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi) };
+            const __m128i color = _mm_set1_epi32(int(layers[l].color));
+            for (int k = 0; k < 4; ++k) {
+                c[k] = _mm_or_si128(_mm_andnot_si128(m[k], c[k]), _mm_and_si128(m[k], color));
+            }
+        }
+        for (int k = 0; k < 4; ++k) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + k * 4), c[k]);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        quint32 c = 0;
+        for (uint l = 0; l < layerCount; ++l) {
+            if (layers[l].levels[offset + i] > layers[l].limit) {
+                c = layers[l].color;
+            }
+        }
+        out[i] = c;
+    }
+}
+
+// Levels each overlay is thresholded on, in the order they are drawn.
+const AgricultureInfo::DataType OverlayLevels[3] = { AgricultureInfo::Water, AgricultureInfo::EnvFertility, AgricultureInfo::Fodder };
+
+// Quantized levels of OverlayLevels, one plane each, laid out as the overlay image: row x holds the
+// cells of grid row x with y mirrored.
+std::vector<quint8> buildLevelIndex(const AgricultureInfo::Data& data)
+{
+    const uint width = data.width();
+    const uint height = data.height();
+    const size_t cells = size_t(width) * height;
+    std::vector<quint8> r(cells * std::size(OverlayLevels));
+    for (size_t l = 0; l < std::size(OverlayLevels); ++l) {
+        const float* plane = data.plane(OverlayLevels[l]);
+        quint8* dst = r.data() + l * cells;
+        for (uint x = 0; x < width; ++x) {
+            const float* row = plane + size_t(x) * height;
+            quint8* out = dst + size_t(x) * height + height - 1;
+            for (uint y = 0; y < height; ++y) {
+                out[-qptrdiff(y)] = quantizeLevel(row[y]);
+            }
+        }
+    }
+    return r;
+}
+
+// The enabled overlays at one pixel per cell; cell (x, y) lands at column height - 1 - y, row x.
+// Null when every overlay is off.
+QImage rasterAgriculture(const DrawOptions& opt, const AgricultureInfo::Data& data, const std::vector<quint8>& levels)
+{
+    const uint width = data.width();
+    const uint height = data.height();
+    const size_t cells = size_t(width) * height;
+    const uint limits[3] = { opt.water, opt.fertility, opt.fodder };
+    const QRgb colors[3] = { qRgb(128, 194, 255), qRgb(194, 255, 194), qRgb(128, 255, 194) };
+    OverlayLayer layers[3];
+    uint layerCount = 0;
+    for (uint l = 0; l < 3; ++l) {
+        if (limits[l]) {
+            layers[layerCount++] = { levels.data() + l * cells, quint8(qMin(limits[l], 100u)), colors[l] };
+        }
+    }
+    if (layerCount == 0) {
+        return QImage();
+    }
+    QImage image(height, width, QImage::Format_ARGB32_Premultiplied);
+    for (uint x = 0; x < width; ++x) {
+        rasterOverlayRow(layers, layerCount, size_t(x) * height, height, reinterpret_cast<quint32*>(image.scanLine(x)));
+    }
+    return image;
+}
+
+void drawAgriculture(QPainter& p, const QImage& overlay, float scale, uint imageWidth)
+{
+    constexpr float cellSize = 5;
+    const uint height = overlay.width();
+    const uint width = overlay.height();
+    const float k = cellSize / scale;
+    p.drawImage(QRectF(imageWidth - (height - 1) * k, 0, height * k, width * k), overlay);
+}
+
+// The digits and the infinity sign pre-rendered once in the default font, so a label is a few blits
+// instead of a text layout. Read-only after construction, so all threads can draw from it.
+struct GlyphAtlas
+{
+    static constexpr int Infinity = 10;
+
+    QImage image;
+    int height = 0;
+    int x[11] = {};
+    int width[11] = {};
+
+    GlyphAtlas()
+    {
+        const QFont font;
+        const QFontMetrics metrics(font);
+        const QString glyphs = QString("0123456789∞");
+        int total = 0;
+        for (int i = 0; i < glyphs.size(); ++i) {
+            x[i] = total;
+            width[i] = metrics.horizontalAdvance(glyphs[i]);
+            total += width[i];
+        }
+        height = metrics.height();
+        image = QImage(qMax(total, 1), qMax(height, 1), QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter p(&image);
+        p.setFont(font);
+        p.setPen(Qt::black);
+        for (int i = 0; i < glyphs.size(); ++i) {
+            p.drawText(x[i], metrics.ascent(), QString(glyphs[i]));
+        }
+    }
+
+    // The glyphs of a label, returning how many; `out` has room for 10.
+    static int glyphs(const MineralData& m, int* out)
+    {
+        if (m.deep) {
+            out[0] = Infinity;
+            return 1;
+        }
+        char digits[16];
+        const int n = qsnprintf(digits, sizeof(digits), "%u", m.amount);
+        for (int i = 0; i < n; ++i) {
+            out[i] = digits[i] - '0';
+        }
+        return n;
+    }
+
+    int textWidth(const int* glyphs, int count) const
+    {
+        int r = 0;
+        for (int i = 0; i < count; ++i) {
+            r += width[glyphs[i]];
+        }
+        return r;
+    }
+
+    void draw(QPainter& p, const QPoint& topLeft, const int* glyphs, int count) const
+    {
+        int left = topLeft.x();
+        for (int i = 0; i < count; ++i) {
+            p.drawImage(QPoint(left, topLeft.y()), image, QRect(x[glyphs[i]], 0, width[glyphs[i]], height));
+            left += width[glyphs[i]];
+        }
+    }
+};
+
+const GlyphAtlas& glyphAtlas()
+{
+    static const GlyphAtlas atlas;
+    return atlas;
+}
+
+// Places the labels of the shown minerals greedily, deep and rich deposits first: below the marker
+// if it is free, else above, right or left of it, else not at all. Placed labels are kept in a
+// hash grid of label-sized cells, so each candidate is checked against a few neighbours only.
+MineralLabelLayout layoutLabels(const GameMapSnapshot& snapshot, const DrawOptions& opt, float scale, uint imageWidth)
+{
+    const GlyphAtlas& atlas = glyphAtlas();
+    const int h = atlas.height;
+    struct Candidate
+    {
+        uint mineral;
+        int width;
+    };
+    std::vector<Candidate> candidates;
+    int maxWidth = 1;
+    for (size_t i = 0; i < snapshot.minerals.size(); ++i) {
+        const MineralData& m = snapshot.minerals[i];
+        if (!checkMineralOption(m.type, opt)) {
+            continue;
+        }
+        int glyphs[10];
+        const int width = atlas.textWidth(glyphs, GlyphAtlas::glyphs(m, glyphs));
+        candidates.push_back({ uint(i), width });
+        maxWidth = qMax(maxWidth, width);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&snapshot](const Candidate& a, const Candidate& b) {
+        const MineralData& ma = snapshot.minerals[a.mineral];
+        const MineralData& mb = snapshot.minerals[b.mineral];
+        return bool(ma.deep) != bool(mb.deep) ? bool(ma.deep) : ma.amount > mb.amount;
+    });
+
+    MineralLabelLayout r;
+    const int cellWidth = maxWidth;
+    const int cellHeight = qMax(h, 1);
+    QHash<quint64, QVarLengthArray<uint, 4>> grid;
+    auto cellKey = [](int x, int y) {
+        return quint64(quint32(y)) << 32 | quint32(x);
+    };
+    auto cells = [&](const QRect& rect, auto f) {
+        const int x0 = int(std::floor(double(rect.left()) / cellWidth));
+        const int x1 = int(std::floor(double(rect.right()) / cellWidth));
+        const int y0 = int(std::floor(double(rect.top()) / cellHeight));
+        const int y1 = int(std::floor(double(rect.bottom()) / cellHeight));
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                f(cellKey(x, y));
+            }
+        }
+    };
+    for (const Candidate& c : candidates) {
+        const MineralData& m = snapshot.minerals[c.mineral];
+        const int cx = int(imageWidth - m.p.x / scale);
+        const int cz = int(m.p.z / scale);
+        const int w = c.width;
+        // Below is where the labels always were: centred in 16 rows under the 20 px marker.
+        const QRect options[4] = {
+            QRect(cx - w / 2, cz + 10 + (16 - h) / 2, w, h),
+            QRect(cx - w / 2, cz - 10 - h, w, h),
+            QRect(cx + 11, cz - h / 2, w, h),
+            QRect(cx - 11 - w, cz - h / 2, w, h),
+        };
+        for (const QRect& rect : options) {
+            bool free = true;
+            cells(rect, [&](quint64 key) {
+                const auto it = grid.constFind(key);
+                if (it == grid.constEnd()) {
+                    return;
+                }
+                for (uint placed : *it) {
+                    free = free && !r.labels[placed].rect.intersects(rect);
+                }
+            });
+            if (free) {
+                const uint index = uint(r.labels.size());
+                r.labels.push_back({ c.mineral, rect });
+                cells(rect, [&](quint64 key) {
+                    grid[key].append(index);
+                });
+                break;
+            }
+        }
+    }
+    return r;
+}
+
+// Entities whose markers reach into one band of image rows, as indices into the snapshot's lists.
+struct BandEntities
+{
+    std::vector<uint> animalsSpawns;
+    std::vector<uint> minerals;
+    std::vector<uint> forageables;
+    std::vector<uint> animals;
+    std::vector<uint> raiders;
+    std::vector<uint> houses;
+    // Into MineralLabelLayout::labels.
+    std::vector<uint> labels;
+};
+
+// Bins the entities drawn in `area` of the image into `bandCount` bands of `bandHeight` rows
+// starting at the top of `area`, by the rows their markers (and labels) cover as drawLayer draws
+// them, plus a pixel for the pen. Point entities come from the spatial index, so a small area only
+// looks at its neighbourhood; every list stays in its drawing order.
+std::vector<BandEntities> binEntities(const GameMapSnapshot& snapshot, const MineralLabelLayout* labels, float scale, uint imageWidth,
+                                      const QRect& area, int bandHeight, int bandCount)
+{
+    constexpr float cellSize = 5;
+    constexpr float areaSize = 64;
+    constexpr float pad = 2;
+    const int top = area.top();
+    std::vector<BandEntities> bands(bandCount);
+    // Indices of the entities of `kind` whose position is within `margin` pixels of `area`.
+    auto near = [&](EntityKind kind, float margin) {
+        const float m = (margin + pad) * scale;
+        const QRectF world(QPointF((imageWidth - area.right() - 1) * scale - m, area.top() * scale - m),
+                           QPointF((imageWidth - area.left()) * scale + m, (area.bottom() + 1) * scale + m));
+        std::vector<uint> r;
+        snapshot.index.forEachInRect(world, SpatialIndex::kindMask(kind), [&r](EntityRef e, float, float) {
+            r.push_back(e.index);
+        });
+        std::sort(r.begin(), r.end());
+        return r;
+    };
+    auto add = [&](std::vector<uint> BandEntities::*list, size_t index, float y0, float y1) {
+        const float first = std::floor((y0 - pad - top) / bandHeight);
+        const float last = std::floor((y1 + pad - top) / bandHeight);
+        if (!(last >= 0 && first < bandCount)) {
+            return;
+        }
+        for (int b = first > 0 ? int(first) : 0; b <= int(qMin(last, float(bandCount - 1))); ++b) {
+            (bands[b].*list).push_back(uint(index));
+        }
+    };
+    const uint lx = imageWidth / areaSize * scale;
+    for (size_t i = 0; lx && i < snapshot.animalsSpawns.size(); ++i) {
+        const float y = snapshot.animalsSpawns[i].spawnArea / lx * areaSize / scale;
+        add(&BandEntities::animalsSpawns, i, y, y + areaSize / scale);
+    }
+    for (uint i : near(EntityKind::Mineral, 10)) {
+        const float z = snapshot.minerals[i].p.z / scale;
+        add(&BandEntities::minerals, i, z - 10, z + 10);
+    }
+    for (size_t i = 0; labels && i < labels->labels.size(); ++i) {
+        const QRect& rect = labels->labels[i].rect;
+        if (rect.right() >= area.left() && rect.left() <= area.right()) {
+            add(&BandEntities::labels, i, rect.top(), rect.bottom() + 1);
+        }
+    }
+    for (uint i : near(EntityKind::Forageable, 4)) {
+        const float z = snapshot.forageables[i].p.z / scale;
+        add(&BandEntities::forageables, i, z - 4, z + 4);
+    }
+    for (uint i : near(EntityKind::Animal, 5)) {
+        const float z = snapshot.animals[i].p.z / scale;
+        add(&BandEntities::animals, i, z - 5, z + 5);
+    }
+    for (size_t i = 0; i < snapshot.raiders.size(); ++i) {
+        // Drawn as a line from the spawn point, so not a point query.
+        const auto& m = snapshot.raiders[i];
+        const float z0 = qMin(m.p.z, m.spawn.z) / scale;
+        const float z1 = qMax(m.p.z, m.spawn.z) / scale;
+        add(&BandEntities::raiders, i, z0 - 5, z1 + qMax(5.0f, 3 * scale));
+    }
+    for (uint i : near(EntityKind::House, 5 * cellSize / scale)) {
+        const float z = snapshot.houses[i].p.z / scale;
+        add(&BandEntities::houses, i, z - 5 * cellSize / scale, z);
+    }
+    return bands;
+}
+
+// Entities drawn between two looks at the promise.
+constexpr uint CancelCheckInterval = 256;
+
+bool isCanceled(const QPromise<QImage>* promise)
+{
+    return promise && promise->isCanceled();
+}
+
+// What drawLayer draws with besides the entities of its band.
+struct LayerContext
+{
+    const DrawOptions& opt;
+    const GameMapSnapshot& snapshot;
+    const MineralLabelLayout* labels;
+    const SpriteAtlas* sprites;
+    float scale;
+    uint imageWidth;
+};
+
+// Draws one of the entity layers of the map, only the entities in `e`; the z-order is that of
+// MapRenderer::Layer. Markers are blits from the sprite atlas. Returns false if `promise` was
+// canceled before the layer was finished.
+bool drawLayer(QPainter& p, MapRenderer::Layer layer, const LayerContext& c, const BandEntities& e, const QPromise<QImage>* promise)
+{
+    constexpr float areaSize = 64;
+    const DrawOptions& opt = c.opt;
+    const GameMapSnapshot& snapshot = c.snapshot;
+    const SpriteAtlas& sprites = *c.sprites;
+    const float scale = c.scale;
+    const uint imageWidth = c.imageWidth;
+    uint drawn = 0;
+    auto canceled = [&] {
+        return ++drawn % CancelCheckInterval == 0 && isCanceled(promise);
+    };
+    auto anchor = [&](const Point& pt) {
+        return QPointF(imageWidth - pt.x / scale, pt.z / scale).toPoint();
+    };
+    switch (layer) {
+    case MapRenderer::SpawnAreas: {
+        uint lx = imageWidth / areaSize * scale;
+
+        for (uint i : e.animalsSpawns) {
+            const auto& s = snapshot.animalsSpawns[i];
+            if (canceled()) {
+                return false;
+            }
+            QColor pc;
+            QColor bc;
+            switch (s.type)
+            {
+            case BaseType::Bear:
+            case BaseType::Wolf:
+                pc = Qt::red;
+                bc = QColor(255, 212, 212, 128);
+                break;
+            case BaseType::Deer:
+                pc = QColor(0, 192, 0);
+                bc = QColor(212, 255, 212, 128);
+                break;
+            case BaseType::Boar:
+                pc = QColor(255, 216, 0);
+                bc = QColor(255, 233, 128, 128);
+                break;
+            default:
+                continue;
+            }
+            p.setPen(pc);
+            p.setBrush(bc);
+            uint y = s.spawnArea / lx;
+            uint x = s.spawnArea % lx + 1;
+            p.drawRect(imageWidth - x * areaSize / scale, y * areaSize / scale, areaSize / scale, areaSize / scale);
+        }
+        break;
+    }
+    case MapRenderer::Minerals: {
+        for (uint i : e.minerals) {
+            const auto& m = snapshot.minerals[i];
+            if (canceled()) {
+                return false;
+            }
+            if (checkMineralOption(m.type, opt)) {
+                sprites.draw(p, SpriteAtlas::mineral(m.type), anchor(m.p));
+            }
+        }
+        break;
+    }
+    case MapRenderer::Forageables: {
+        for (uint i : e.forageables) {
+            const auto& m = snapshot.forageables[i];
+            if (canceled()) {
+                return false;
+            }
+            switch (m.type)
+            {
+            case GameItem::Greens:
+                if (!opt.greens)
+                    continue;
+                break;
+            case GameItem::Herbs:
+                if (!opt.herbs)
+                    continue;
+                break;
+            case GameItem::Willow:
+                if (!opt.willow)
+                    continue;
+                break;
+            case GameItem::Roots:
+                if (!opt.roots)
+                    continue;
+                break;
+            default:
+                continue;
+            }
+            sprites.draw(p, SpriteAtlas::forageable(m.type, m.amount), anchor(m.p));
+        }
+        break;
+    }
+    case MapRenderer::Animals: {
+        for (uint i : e.animals) {
+            const auto& m = snapshot.animals[i];
+            if (canceled()) {
+                return false;
+            }
+            const SpriteAtlas::Sprite sprite = SpriteAtlas::animal(m.type);
+            if (sprite != SpriteAtlas::None) {
+                sprites.draw(p, sprite, anchor(m.p));
+            }
+        }
+        break;
+    }
+    case MapRenderer::Enemies: {
+        p.setPen(Qt::lightGray);
+        for (uint i : e.raiders) {
+            const auto& m = snapshot.raiders[i];
+            if (canceled()) {
+                return false;
+            }
+            p.drawLine(imageWidth - m.p.x / scale, m.p.z / scale, imageWidth - m.spawn.x / scale, m.spawn.z / scale);
+            sprites.draw(p, SpriteAtlas::RaiderCross, anchor(m.p));
+        }
+        for (uint i : e.raiders) {
+            const auto& m = snapshot.raiders[i];
+            if (canceled()) {
+                return false;
+            }
+            sprites.draw(p, m.type == RaiderType::BatteringRam ? SpriteAtlas::BatteringRam : SpriteAtlas::Raider, anchor(m.p));
+        }
+        break;
+    }
+    case MapRenderer::Buildings: {
+        for (uint i : e.houses) {
+            const auto& m = snapshot.houses[i];
+            if (canceled()) {
+                return false;
+            }
+            if (m.type == BaseType::Shelter || m.type == BaseType::TownCenter) {
+                sprites.draw(p, m.type == BaseType::Shelter ? SpriteAtlas::Shelter : SpriteAtlas::TownCenter, anchor(m.p));
+            }
+        }
+        break;
+    }
+    case MapRenderer::MineralLabels: {
+        const GlyphAtlas& atlas = glyphAtlas();
+        for (uint i : e.labels) {
+            const auto& label = c.labels->labels[i];
+            if (canceled()) {
+                return false;
+            }
+            int glyphs[10];
+            atlas.draw(p, label.rect.topLeft(), glyphs, GlyphAtlas::glyphs(snapshot.minerals[label.mineral], glyphs));
+        }
+        break;
+    }
+    case MapRenderer::Camera: {
+        sprites.draw(p, SpriteAtlas::Camera, anchor(snapshot.camera));
+        break;
+    }
+    case MapRenderer::Agriculture:
+    case MapRenderer::LayerCount:
+        break;
+    }
+    return true;
+}
+
+// Packs the options a layer depends on; 0 means the layer is off.
+quint64 layerKey(MapRenderer::Layer layer, const DrawOptions& opt)
+{
+    switch (layer) {
+    case MapRenderer::Agriculture:
+        return quint64(opt.water) | quint64(opt.fertility) << 16 | quint64(opt.fodder) << 32;
+    case MapRenderer::SpawnAreas:
+        return opt.animalsSpawns;
+    case MapRenderer::Minerals:
+    case MapRenderer::MineralLabels:
+        return quint64(opt.clay) | quint64(opt.sand) << 1 | quint64(opt.coal) << 2 | quint64(opt.iron) << 3
+                | quint64(opt.gold) << 4 | quint64(opt.stone) << 5;
+    case MapRenderer::Forageables:
+        return quint64(opt.greens) | quint64(opt.herbs) << 1 | quint64(opt.roots) << 2 | quint64(opt.willow) << 3;
+    case MapRenderer::Animals:
+        return opt.animals;
+    case MapRenderer::Enemies:
+        return opt.enemies;
+    case MapRenderer::Buildings:
+        return opt.buildings;
+    case MapRenderer::Camera:
+        return 1;
+    case MapRenderer::LayerCount:
+        break;
+    }
+    return 0;
+}
+
+// Whether a band has nothing for an entity layer to draw.
+bool layerEmpty(MapRenderer::Layer layer, const BandEntities& e)
+{
+    switch (layer) {
+    case MapRenderer::SpawnAreas:
+        return e.animalsSpawns.empty();
+    case MapRenderer::Minerals:
+        return e.minerals.empty();
+    case MapRenderer::Forageables:
+        return e.forageables.empty();
+    case MapRenderer::Animals:
+        return e.animals.empty();
+    case MapRenderer::Enemies:
+        return e.raiders.empty();
+    case MapRenderer::Buildings:
+        return e.houses.empty();
+    case MapRenderer::MineralLabels:
+        return e.labels.empty();
+    case MapRenderer::Agriculture:
+    case MapRenderer::Camera:
+    case MapRenderer::LayerCount:
+        break;
+    }
+    return false;
+}
+
+// The snapshot part a layer is drawn from.
+GameMapSnapshot::Part layerPart(MapRenderer::Layer layer)
+{
+    switch (layer) {
+    case MapRenderer::Agriculture:
+        return GameMapSnapshot::Agriculture;
+    case MapRenderer::SpawnAreas:
+        return GameMapSnapshot::AnimalSpawns;
+    case MapRenderer::Minerals:
+    case MapRenderer::MineralLabels:
+        return GameMapSnapshot::Minerals;
+    case MapRenderer::Forageables:
+        return GameMapSnapshot::Forageables;
+    case MapRenderer::Animals:
+        return GameMapSnapshot::Animals;
+    case MapRenderer::Enemies:
+        return GameMapSnapshot::Raiders;
+    case MapRenderer::Buildings:
+        return GameMapSnapshot::Houses;
+    case MapRenderer::Camera:
+    case MapRenderer::LayerCount:
+        break;
+    }
+    return GameMapSnapshot::Camera;
+}
+
+}
+
+MapProjection MapProjection::of(const GameMapSnapshot& snapshot, float scale)
+{
+    return { scale, uint(snapshot.agricultureData.worldWidth / scale), uint(snapshot.agricultureData.worldHeight / scale) };
+}
+
+QImage MapRenderer::render(const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot, float scale,
+                          const QPromise<QImage>* promise)
+{
+    if (snapshot.isNull()) {
+        return QImage();
+    }
+    const MapProjection projection = MapProjection::of(*snapshot, scale);
+    const uint imageWidth = projection.imageWidth;
+    const int imageHeight = int(projection.imageHeight);
+    QImage image(projection.imageSize(), QImage::Format_RGB32);
+    if (image.isNull()) {
+        return image;
+    }
+
+    bool enabled[LayerCount] = {};
+    bool entities = false;
+    for (int i = 0; i < LayerCount; ++i) {
+        enabled[i] = layerKey(static_cast<Layer>(i), opt) != 0;
+        entities = entities || (enabled[i] && i != Agriculture);
+    }
+    QImage overlay;
+    QSharedPointer<const MineralLabelLayout> labels;
+    QSharedPointer<const SpriteAtlas> sprites;
+    {
+        QMutexLocker lock(&mutex_);
+        if (snapshot != snapshot_) {
+            reset(snapshot);
+        }
+        if (enabled[Agriculture]) {
+            overlay = agricultureImage(opt);
+        }
+        if (enabled[MineralLabels]) {
+            labels = labelLayout(opt, scale);
+        }
+        sprites = spriteAtlas(scale);
+    }
+    const LayerContext context{ opt, *snapshot, labels.data(), sprites.data(), scale, imageWidth };
+
+    // Horizontal bands painted in parallel. Each band paints through an image that shares the rows
+    // of the full one, so the threads never touch the same pixels and nothing is copied.
+    constexpr int minBandHeight = 32;
+    const int bandCount = qBound(1, imageHeight / minBandHeight, QThread::idealThreadCount() * 2);
+    const int bandHeight = (imageHeight + bandCount - 1) / bandCount;
+    const std::vector<BandEntities> bins = entities ? binEntities(*snapshot, labels.data(), scale, imageWidth, image.rect(), bandHeight, bandCount)
+                                                    : std::vector<BandEntities>(bandCount);
+    uchar* imageBits = image.bits();
+    const qsizetype bytesPerLine = image.bytesPerLine();
+
+    std::vector<int> bands(bandCount);
+    std::iota(bands.begin(), bands.end(), 0);
+    std::atomic_bool canceled = false;
+    QtConcurrent::blockingMap(bands, [&](int b) {
+        const int top = b * bandHeight;
+        const int height = qMin(bandHeight, imageHeight - top);
+        if (height <= 0) {
+            return;
+        }
+        QImage band(imageBits + top * bytesPerLine, imageWidth, height, bytesPerLine, QImage::Format_RGB32);
+        band.fill(Qt::white);
+        QPainter p(&band);
+        p.translate(0, -top);
+        for (int i = 0; i < LayerCount; ++i) {
+            if (!enabled[i]) {
+                continue;
+            }
+            if (canceled || isCanceled(promise)) {
+                canceled = true;
+                return;
+            }
+            if (i == Agriculture) {
+                if (!overlay.isNull()) {
+                    drawAgriculture(p, overlay, scale, imageWidth);
+                }
+            } else if (!drawLayer(p, static_cast<Layer>(i), context, bins[b], promise)) {
+                canceled = true;
+                return;
+            }
+        }
+    });
+    return canceled ? QImage() : image;
+}
+
+void MapRenderer::renderTile(QPromise<QImage>& promise, const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot,
+                             float scale, const QRect& rect)
+{
+    if (snapshot.isNull() || rect.isEmpty() || promise.isCanceled()) {
+        return;
+    }
+    // The layers of this tile drawn earlier for the same options and snapshot parts are reused;
+    // the stale ones are redrawn.
+    quint64 keys[LayerCount] = {};
+    QImage images[LayerCount];
+    bool stale[LayerCount] = {};
+    QImage overlay;
+    QSharedPointer<const MineralLabelLayout> labels;
+    QSharedPointer<const SpriteAtlas> sprites;
+    {
+        QMutexLocker lock(&mutex_);
+        if (snapshot != snapshot_) {
+            reset(snapshot);
+        }
+        for (int i = 0; i < Camera; ++i) {
+            const Layer layer = static_cast<Layer>(i);
+            keys[i] = layerKey(layer, opt);
+            if (keys[i] == 0) {
+                continue;
+            }
+            const TileLayer* cached = tileLayers_.object(TileLayerKey{ scale, rect, i });
+            if (cached && cached->key == keys[i] && cached->revision == snapshot->revisions[layerPart(layer)]
+                && cached->projection == snapshot->revisions[GameMapSnapshot::Agriculture]) {
+                images[i] = cached->image;
+            } else {
+                stale[i] = true;
+            }
+        }
+        if (stale[Agriculture]) {
+            overlay = agricultureImage(opt);
+        }
+        if (stale[MineralLabels]) {
+            labels = labelLayout(opt, scale);
+        }
+        sprites = spriteAtlas(scale);
+    }
+    if (promise.isCanceled()) {
+        return;
+    }
+    const uint imageWidth = MapProjection::of(*snapshot, scale).imageWidth;
+    const LayerContext context{ opt, *snapshot, labels.data(), sprites.data(), scale, imageWidth };
+    BandEntities entities;
+    bool binned = false;
+    QImage image(rect.size(), QImage::Format_RGB32);
+    image.fill(Qt::white);
+    QPainter p(&image);
+    bool terrain = false;
+    for (int i = 0; i < Camera; ++i) {
+        const Layer layer = static_cast<Layer>(i);
+        if (keys[i] == 0) {
+            continue;
+        }
+        if (stale[i]) {
+            if (layer > SpawnAreas && terrain) {
+                // The terrain alone is worth showing while the entities are drawn.
+                terrain = false;
+                p.end();
+                promise.addResult(image);
+                p.begin(&image);
+            }
+            if (layer != Agriculture && !binned) {
+                // A tile is a single band.
+                entities = binEntities(*snapshot, labels.data(), scale, imageWidth, rect, rect.height(), 1).front();
+                binned = true;
+            }
+            // A layer without anything in this tile is kept as a null image.
+            QImage drawn;
+            if (layer == Agriculture ? !overlay.isNull() : !layerEmpty(layer, entities)) {
+                drawn = QImage(rect.size(), QImage::Format_ARGB32_Premultiplied);
+                drawn.fill(Qt::transparent);
+                QPainter lp(&drawn);
+                lp.translate(-rect.topLeft());
+                if (layer == Agriculture) {
+                    drawAgriculture(lp, overlay, scale, imageWidth);
+                } else if (!drawLayer(lp, layer, context, entities, &promise)) {
+                    return;
+                }
+            }
+            if (promise.isCanceled()) {
+                return;
+            }
+            images[i] = drawn;
+            QMutexLocker lock(&mutex_);
+            tileLayers_.insert(TileLayerKey{ scale, rect, i },
+                               new TileLayer{ keys[i], snapshot->revisions[layerPart(layer)],
+                                              snapshot->revisions[GameMapSnapshot::Agriculture], drawn },
+                               qMax<qsizetype>(1, drawn.sizeInBytes() / 1024));
+        }
+        if (!images[i].isNull()) {
+            p.drawImage(0, 0, images[i]);
+            terrain = terrain || layer <= SpawnAreas;
+        }
+    }
+    p.translate(-rect.topLeft());
+    drawLayer(p, Camera, context, entities, nullptr);
+    p.end();
+    promise.addResult(std::move(image));
+}
+
+void MapRenderer::clear()
+{
+    QMutexLocker lock(&mutex_);
+    reset(nullptr);
+    tileLayers_.clear();
+}
+
+// Drops everything derived from parts of the previous snapshot that `snapshot` doesn't share; the
+// caller holds mutex_. Tile layers keep the revisions they were drawn from and are checked by
+// renderTile instead, so a save that only moved raiders redraws only the enemies.
+void MapRenderer::reset(const QSharedPointer<const GameMapSnapshot>& snapshot)
+{
+    auto changed = [&](GameMapSnapshot::Part part) {
+        return snapshot_.isNull() || snapshot.isNull() || snapshot_->revisions[part] != snapshot->revisions[part];
+    };
+    const bool all = changed(GameMapSnapshot::Agriculture);
+    if (all) {
+        agriculture_ = CachedLayer();
+        levelIndex_.clear();
+    }
+    if (all || changed(GameMapSnapshot::Minerals)) {
+        labels_.reset();
+    }
+    snapshot_ = snapshot;
+}
+
+// The caller holds mutex_ and has reset() to the current snapshot.
+QImage MapRenderer::agricultureImage(const DrawOptions& opt)
+{
+    const quint64 key = layerKey(Agriculture, opt);
+    if (key == 0 || snapshot_->agricultureData.isEmpty()) {
+        return QImage();
+    }
+    if (agriculture_.key != key) {
+        if (levelIndex_.empty()) {
+            levelIndex_ = buildLevelIndex(snapshot_->agricultureData);
+        }
+        agriculture_.key = key;
+        agriculture_.image = rasterAgriculture(opt, snapshot_->agricultureData, levelIndex_);
+    }
+    return agriculture_.image;
+}
+
+// The caller holds mutex_ and has reset() to the current snapshot.
+QSharedPointer<const MineralLabelLayout> MapRenderer::labelLayout(const DrawOptions& opt, float scale)
+{
+    const quint64 key = layerKey(MineralLabels, opt);
+    if (labels_.isNull() || labelsKey_ != key || labelsScale_ != scale) {
+        labelsKey_ = key;
+        labelsScale_ = scale;
+        labels_ = QSharedPointer<const MineralLabelLayout>::create(
+                    layoutLabels(*snapshot_, opt, scale, MapProjection::of(*snapshot_, scale).imageWidth));
+    }
+    return labels_;
+}
+
+// The caller holds mutex_. Sprites don't depend on the snapshot, so they outlive reset().
+QSharedPointer<const SpriteAtlas> MapRenderer::spriteAtlas(float scale)
+{
+    QSharedPointer<const SpriteAtlas>& r = sprites_[scale];
+    if (r.isNull()) {
+        r = QSharedPointer<const SpriteAtlas>::create(scale);
+    }
+    return r;
+}
+
+QPoint agricultureCellAt(float x, float z)
+{
+    constexpr float cellSize = 5;
+    // drawAgriculture puts the column of cell y at image x imageWidth - y * cellSize / scale,
+    // so it covers world x in ((y - 1) * cellSize, y * cellSize].
+    const float gx = std::floor(z / cellSize);
+    const float gy = std::ceil(x / cellSize);
+    if (!(std::abs(gx) < 1e6f && std::abs(gy) < 1e6f)) {
+        return QPoint(-1, -1);
+    }
+    return QPoint(int(gx), int(gy));
+}
+
+QImage renderMap(const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot, float scale)
+{
+    return MapRenderer().render(opt, snapshot, scale);
+}
@@ -0,0 +1,165 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef MAPRENDERER_H
+#define MAPRENDERER_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QPromise>
+#include <QSharedPointer>
+
+#include <vector>
+
+struct GameMapSnapshot;
+struct MineralLabelLayout;
+struct SpriteAtlas;
+
+struct DrawOptions
+{
+    bool sand = false;
+    bool clay = false;
+    bool coal = false;
+    bool iron = false;
+    bool gold = false;
+    bool stone = false;
+
+    bool greens = false;
+    bool herbs = false;
+    bool roots = false;
+    bool willow = false;
+
+    bool animals = false;
+    bool animalsSpawns = false;
+    bool enemies = false;
+    bool buildings = false;
+
+    uint fertility = 0;
+    uint fodder = 0;
+    uint water = 0;
+};
+
+// Maps world coordinates (x, z) to pixels of the map image drawn at `scale` world units per pixel.
+// The image is mirrored horizontally, as the game shows it.
+struct MapProjection
+{
+    float scale = 2;
+    uint imageWidth = 0;
+    uint imageHeight = 0;
+
+    static MapProjection of(const GameMapSnapshot& snapshot, float scale);
+
+    QSize imageSize() const { return QSize(imageWidth, imageHeight); }
+    QPointF toImage(float x, float z) const { return QPointF(imageWidth - x / scale, z / scale); }
+    QPointF toWorld(const QPointF& p) const { return QPointF((imageWidth - p.x()) * scale, p.y() * scale); }
+};
+
+// Renders the map one layer at a time. renderTile() keeps each layer of a tile until the options
+// that layer depends on, the snapshot part it is drawn from or the scale change, so toggling a
+// layer only re-composites the tile. render() paints the whole image in horizontal bands on the
+// global thread pool, each with only the entities binned to it, and keeps no images. One renderer
+// can be shared with worker threads.
+class MapRenderer
+{
+public:
+    // In z-order.
+    enum Layer
+    {
+        Agriculture,
+        SpawnAreas,
+        Minerals,
+        Forageables,
+        Animals,
+        Enemies,
+        Buildings,
+        MineralLabels,
+        Camera,
+        LayerCount
+    };
+
+    // Draws every layer of the whole image. Stops early and returns a null image once `promise`,
+    // if any, is canceled.
+    QImage render(const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot, float scale,
+                  const QPromise<QImage>* promise = nullptr);
+    // Renders only `rect` of the map image at `scale` and reports it to `promise`: first the
+    // terrain, when there are entities to draw over it, then the finished tile. Checks for
+    // cancellation between layers and every few hundred entities. Each layer of a tile is kept
+    // with its options key and snapshot part revision, so rendering the tile again after a layer
+    // toggle, a slider move or a followed save only redraws the layers that changed and
+    // re-composites the rest. Tiles can be rendered in parallel.
+    void renderTile(QPromise<QImage>& promise, const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot,
+                    float scale, const QRect& rect);
+    void clear();
+
+private:
+    void reset(const QSharedPointer<const GameMapSnapshot>& snapshot);
+    QImage agricultureImage(const DrawOptions& opt);
+    QSharedPointer<const MineralLabelLayout> labelLayout(const DrawOptions& opt, float scale);
+    QSharedPointer<const SpriteAtlas> spriteAtlas(float scale);
+
+    struct CachedLayer
+    {
+        quint64 key = 0;
+        QImage image;
+    };
+
+    struct TileLayerKey
+    {
+        float scale;
+        QRect rect;
+        int layer;
+
+        bool operator==(const TileLayerKey& o) const { return scale == o.scale && rect == o.rect && layer == o.layer; }
+        friend size_t qHash(const TileLayerKey& k, size_t seed = 0)
+        {
+            return qHashMulti(seed, k.scale, k.rect.x(), k.rect.y(), k.rect.width(), k.rect.height(), k.layer);
+        }
+    };
+
+    // One layer of a tile; a null image when nothing of the layer is in the tile.
+    struct TileLayer
+    {
+        quint64 key;
+        // Of the part the layer is drawn from, and of the agriculture grid the image size follows.
+        quint64 revision;
+        quint64 projection;
+        QImage image;
+    };
+
+    // Cost of a tile layer is its size in KiB.
+    static constexpr int TileLayerBudget = 192 * 1024;
+
+    QMutex mutex_;
+    QSharedPointer<const GameMapSnapshot> snapshot_;
+    // The agriculture overlay at one pixel per cell, so it is shared by every scale.
+    CachedLayer agriculture_;
+    // Mineral labels placed for labelsKey_ at labelsScale_; one layout serves every tile.
+    QSharedPointer<const MineralLabelLayout> labels_;
+    quint64 labelsKey_ = 0;
+    float labelsScale_ = 0;
+    QCache<TileLayerKey, TileLayer> tileLayers_{ TileLayerBudget };
+    // Marker sprites by scale.
+    QHash<float, QSharedPointer<const SpriteAtlas>> sprites_;
+    // Agriculture levels quantized to slider steps, built once per snapshot so a threshold change
+    // is a byte compare per cell.
+    std::vector<quint8> levelIndex_;
+};
+
+// The agriculture grid cell the overlay draws under world (x, z), as (x, y) of AgricultureInfo::Data;
+// may be outside the grid. Grid x runs along world z, grid y along world x.
+QPoint agricultureCellAt(float x, float z);
+
+// Draws the overview of `snapshot` at 1/scale of the world size. Renders into a QImage, so it is
+// safe to call from worker threads and without a display.
+QImage renderMap(const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot, float scale);
+
+#endif // MAPRENDERER_H
@@ -10,317 +10,70 @@
 
 #include "stdafx.h"
 #include "MapWidget.h"
-#include "GameMap.h"
+#include "GameMapSnapshot.h"
+#include "MapInspector.h"
+#include "SaveDiff.h"
 
 namespace {
 
 constexpr int HighlightRadius = 10;
 constexpr int HighlightRect = 15;
 
-bool checkMineralOption(MineralType v, const MapWidget::DrawOptions &opt)
-{
-    switch (v) {
-    case MineralType::Iron:
-        if (!opt.iron)
-            return false;
-        break;
-    case MineralType::Gold:
-        if (!opt.gold)
-            return false;
-        break;
-    case MineralType::Coal:
-        if (!opt.coal)
-            return false;
-        break;
-    case MineralType::Clay:
-        if (!opt.clay)
-            return false;
-        break;
-    case MineralType::Sand:
-        if (!opt.sand)
-            return false;
-        break;
-    case MineralType::Stone:
-        if (!opt.stone)
-            return false;
-        break;
-    }
-    return true;
+constexpr int TileSize = 256;
+// Level 0 is the coarsest; every level halves the scale of the previous one.
+constexpr int LevelCount = 7;
+constexpr float CoarsestScale = 16;
+constexpr int DefaultLevel = 3;
+// Cost of a tile is its size in KiB.
+constexpr int TileCacheBudget = 128 * 1024;
+
+quint64 tileKey(int level, int x, int y)
+{
+    return quint64(level) << 48 | quint64(quint32(y)) << 24 | quint32(x);
 }
 
-uint calcRectCoordinate(int dirtyBegin, int dirtyLen, int mapBegin, int mapLen, int& rDirtyBegin, int& rMapBegin)
+float levelScale(int level)
 {
-    int d = mapBegin - dirtyBegin;
-    int dirtyRight = dirtyBegin + dirtyLen;
-    if (dirtyBegin <= mapBegin) {
-        rDirtyBegin = mapBegin;
-        if (d > dirtyLen) {
-            return 0;
-        } else if (dirtyRight < mapBegin + mapLen) {
-            return dirtyLen - d;
-        } else {
-            return mapLen;
-        }
-    } else if (dirtyBegin > mapBegin && dirtyBegin < mapBegin + mapLen) {
-        rDirtyBegin = dirtyBegin;
-        rMapBegin = -d;
-        if (dirtyRight < mapBegin + mapLen) {
-            return dirtyLen;
-        } else {
-            return mapLen + d;
-        }
-    }
-    return 0;
+    return CoarsestScale / (1 << level);
 }
 
-void drawMap(QPromise<QPixmap>& promise, const MapWidget::DrawOptions& opt, QSharedPointer<GameMap> map, float scale)
+// Whether `b` is a later save of the game of `a`, so the tiles of `a` can stand in until those of
+// `b` are rendered.
+bool sameGame(const GameMapSnapshot* a, const GameMapSnapshot* b)
 {
-    if (map.isNull()) {
-        promise.addResult(QPixmap());
-        return;
-    }
-    auto reader = map->reader();
-    auto agricultureData = reader.agricultureData();
-    uint imageWidth = agricultureData.worldWidth / scale;
-    uint imageHeight = agricultureData.worldHeight / scale;
-    constexpr float cellSize = 5;
-    constexpr float areaSize = 64;
-    QPixmap image(imageWidth, imageHeight);
-    image.fill(Qt::white);
-    QPainter p(&image);
-    auto drawLevel = [&](const QColor& color, const std::vector<std::vector<float>>& array, float limit) {
-        p.setPen(color);
-        p.setBrush(color);
-        for (int x = 0; x < array.size(); ++x) {
-            for (int y = 0; y < array[x].size(); ++y) {
-                if (array[x][y] > limit) {
-                    p.drawRect(imageWidth - y * cellSize / scale, x * cellSize / scale, cellSize / scale, cellSize / scale);
-                }
-            }
-        }
-        if (promise.isCanceled()) {
-            return;
-        }
-    };
-    if (opt.water)
-    {
-        drawLevel(QColor(128, 194, 255), agricultureData.data[AgricultureInfo::Water], opt.water / 100.0);
-    }
-    if (opt.fertility)
-    {
-        drawLevel(QColor(194, 255, 194), agricultureData.data[AgricultureInfo::EnvFertility], opt.fertility / 100.0);
-    }
-    if (opt.fodder)
-    {
-        drawLevel(QColor(128, 255, 194), agricultureData.data[AgricultureInfo::Fodder], opt.fodder / 100.0);
-    }
-    if (opt.animalsSpawns) {
-        uint lx = imageWidth / areaSize * scale;
-
-        for (const auto& s : reader.animalsSpawns()) {
-            QColor pc;
-            QColor bc;
-            switch (s.type)
-            {
-            case BaseType::Bear:
-            case BaseType::Wolf:
-                pc = Qt::red;
-                bc = QColor(255, 212, 212, 128);
-                break;
-            case BaseType::Deer:
-                pc = QColor(0, 192, 0);
-                bc = QColor(212, 255, 212, 128);
-                break;
-            case BaseType::Boar:
-                pc = QColor(255, 216, 0);
-                bc = QColor(255, 233, 128, 128);
-                break;
-            default:
-                continue;
-            }
-            p.setPen(pc);
-            p.setBrush(bc);
-            uint y = s.spawnArea / lx;
-            uint x = s.spawnArea % lx + 1;
-            p.drawRect(imageWidth - x * areaSize / scale, y * areaSize / scale, areaSize / scale, areaSize / scale);
-        }
-    }
-    std::vector<MineralData> mineralsList;
-    bool anyMinerals = opt.clay || opt.sand || opt.coal || opt.iron || opt.gold || opt.stone;
-    if (anyMinerals) {
-        mineralsList = reader.minerals();
-        for (const auto& m : mineralsList) {
-            if (!checkMineralOption(m.type, opt)) {
-                continue;
-            }
-            auto c = mineralColor(m.type);
-            p.setPen(c);
-            p.setBrush(c);
-            p.drawEllipse(imageWidth - m.p.x / scale - 10, m.p.z / scale - 10, 20, 20);
-        }
-    }
-    if (opt.greens || opt.herbs || opt.roots || opt.willow) {
-        for (const auto& m : reader.forageables()) {
-            switch (m.type)
-            {
-            case GameItem::Greens:
-                if (!opt.greens)
-                    continue;
-                break;
-            case GameItem::Herbs:
-                if (!opt.herbs)
-                    continue;
-                break;
-            case GameItem::Willow:
-                if (!opt.willow)
-                    continue;
-                break;
-            case GameItem::Roots:
-                if (!opt.roots)
-                    continue;
-                break;
-            default:
-                continue;
-            }
-            QColor bc = itemColor(m.type);
-            int r = 2;
-            if (m.amount > 19)
-                r = 4;
-            else if (m.amount > 14)
-                r = 3;
-            p.setPen(Qt::black);
-            p.setBrush(bc);
-            p.drawEllipse(imageWidth - m.p.x / scale - r, m.p.z / scale - r, r * 2, r * 2);
-        }
-    }
-    if (opt.animals) {
-        for (const auto& m : reader.animals()) {
-            QColor circleColor;
-            QColor crossColor;
-            QColor borderCircleColor;
-            int ls = 5;
-            int r = 3;
-            switch (m.type)
-            {
-            case BaseType::Wolf:
-                crossColor = Qt::red;
-                circleColor = Qt::darkMagenta;
-                borderCircleColor = Qt::darkMagenta;
-                break;
-            case BaseType::WolfDen:
-                crossColor = Qt::black;
-                circleColor = Qt::darkMagenta;
-                borderCircleColor = Qt::black;
-                break;
-            case BaseType::Bear:
-                crossColor = Qt::red;
-                circleColor = Qt::red;
-                borderCircleColor = Qt::red;
-                break;
-            case BaseType::Deer:
-                crossColor = Qt::green;
-                circleColor = QColor(128, 216, 0);
-                borderCircleColor = Qt::green;
-                ls = 4;
-                r = 2;
-                break;
-            case BaseType::Boar:
-                crossColor = Qt::green;
-                circleColor = QColor(255, 216, 0);
-                borderCircleColor = Qt::green;
-                ls = 4;
-                r = 2;
-                break;
-            default:
-                continue;
-            }
-            p.setPen(crossColor);
-            p.drawLine(imageWidth - m.p.x / scale, m.p.z / scale - ls, imageWidth - m.p.x / scale, m.p.z / scale + ls);
-            p.drawLine(imageWidth - m.p.x / scale - ls, m.p.z / scale, imageWidth - m.p.x / scale  + ls, m.p.z / scale);
-            p.setPen(borderCircleColor);
-            p.setBrush(circleColor);
-            p.drawEllipse(imageWidth - m.p.x / scale - r, m.p.z / scale - r, r * 2, r * 2);
-        }
-    }
-    if (opt.enemies) {
-        for (const auto& m : reader.raiders()) {
-            constexpr int ls = 5;
-            p.setPen(Qt::lightGray);
-            p.drawLine(imageWidth - m.p.x / scale, m.p.z / scale, imageWidth - m.spawn.x / scale, m.spawn.z / scale);
-            p.setPen(Qt::magenta);
-            p.drawLine(imageWidth - m.p.x / scale, m.p.z / scale - ls, imageWidth - m.p.x / scale, m.p.z / scale + ls);
-            p.drawLine(imageWidth - m.p.x / scale - ls, m.p.z / scale, imageWidth - m.p.x / scale  + ls, m.p.z / scale);
-        }
-        for (const auto& m : reader.raiders()) {
-            p.setPen(Qt::black);
-            p.setBrush(Qt::black);
-            constexpr int r = 3;
-            p.drawEllipse(imageWidth - m.p.x / scale - r, m.p.z / scale - r, r * scale, r * scale);
-            if (m.type == RaiderType::BatteringRam) {
-                p.setPen(Qt::magenta);
-                constexpr int inner = 2;
-                p.drawEllipse(imageWidth - m.p.x / scale - r, m.p.z / scale - inner, inner * scale, inner * scale);
-            }
-        }
-    }
-    if (opt.buildings) {
-        for (const auto& m : reader.houses()) {
-            int ls = 0;
-            switch (m.type)
-            {
-            case BaseType::Shelter:
-                ls = 3 * cellSize / scale;
-                break;
-            case BaseType::TownCenter:
-                ls = 5 * cellSize / scale;
-                break;
-            default:
-                continue;
-            }
-            p.setPen(Qt::blue);
-            p.setBrush(Qt::blue);
-            p.drawRect(imageWidth - m.p.x / scale - ls, m.p.z / scale - ls, ls, ls);
-        }
-    }
-    if (anyMinerals) {
-        p.setPen(Qt::black);
-        for (const auto& m : mineralsList) {
-            if (checkMineralOption(m.type, opt)) {
-                p.drawText(QRect(imageWidth - m.p.x / scale - 20, m.p.z / scale + 10, 40, 16), Qt::AlignCenter, m.deep ? QString("∞") : QString::number(m.amount));
-            }
-        }
-    }
-    {
-        auto start = reader.camera();
-        p.setPen(Qt::blue);
-        constexpr int ls = 5;
-        p.drawLine(imageWidth - start.x / scale, start.z / scale - ls, imageWidth - start.x / scale, start.z / scale + ls);
-        p.drawLine(imageWidth - start.x / scale - ls, start.z / scale, imageWidth - start.x / scale  + ls, start.z / scale);
-    }
-    promise.addResult(std::move(image));
+    return a != nullptr && b != nullptr && a->generalSaveData.seed == b->generalSaveData.seed
+            && a->generalSaveData.name == b->generalSaveData.name
+            && a->agricultureData.worldWidth == b->agricultureData.worldWidth
+            && a->agricultureData.worldHeight == b->agricultureData.worldHeight;
 }
 
 }
 
 MapWidget::MapWidget(QWidget *parent)
     : QWidget{parent}
-    , scale_(2)
+    , renderer_(QSharedPointer<MapRenderer>::create())
+    , tiles_(TileCacheBudget)
+    , level_(DefaultLevel)
 {
+    redrawTimer_.setSingleShot(true);
+    connect(&redrawTimer_, &QTimer::timeout, this, &MapWidget::startRender);
+    // For the hover inspector.
+    setMouseTracking(true);
 }
 
 MapWidget::~MapWidget()
 {
+    cancelTiles();
 }
 
 void MapWidget::setScale(float v)
 {
-    scale_ = v;
+    setLevel(qRound(std::log2(CoarsestScale / v)));
 }
 
 void MapWidget::setHighlightMouse(bool v)
 {
     highlightMouse_.enabled = v;
-    setMouseTracking(v);
     if (!v && highlightMouse_.show) {
         widgetUpdate(highlightMouse_.p);
         highlightMouse_.show = false;
@@ -329,71 +82,225 @@ void MapWidget::setHighlightMouse(bool v)
 
 void MapWidget::addHighlight(const QPoint &position)
 {
-    QRect br = mapImage_.rect();
-    int mapWidth = br.width();
-    QPoint& p = highlight_.emplace_back(QPoint(mapWidth - position.x() / scale_, position.y() / scale_));
-    widgetUpdate(p);
+    const QPointF& p = highlight_.emplace_back(position);
+    widgetUpdate(toWidget(p).toPoint());
 }
 
 void MapWidget::resetHighlight()
 {
-    for (const QPoint& p : highlight_) {
-        widgetUpdate(p);
+    for (const QPointF& p : highlight_) {
+        widgetUpdate(toWidget(p).toPoint());
     }
     highlight_.clear();
 }
 
-void MapWidget::update(const DrawOptions &opt, const QSharedPointer<GameMap>& map)
+void MapWidget::update(const DrawOptions &opt, const QSharedPointer<const GameMapSnapshot>& snapshot)
 {
-    future_.cancel();
-    future_ = QtConcurrent::run(drawMap, opt, map, scale_);
-    auto watcher = new QFutureWatcher<QPixmap>(this);
+    // Slider drags land here on every step: keep only the newest request and apply at most one
+    // per display frame.
+    pending_ = PendingDraw{ opt, snapshot };
+    if (!redrawTimer_.isActive()) {
+        const qreal refreshRate = screen() ? screen()->refreshRate() : 60;
+        redrawTimer_.setInterval(qMax(1, qRound(1000 / qMax<qreal>(refreshRate, 1))));
+        redrawTimer_.start();
+    }
+}
+
+void MapWidget::setHeightMapSource(HeightMapSource source)
+{
+    heightMapSource_ = std::move(source);
+    heightMap_.reset();
+    heightMapPending_ = false;
+    ++heightMapEpoch_;
+}
 
-    connect(watcher, &QFutureWatcher<QPixmap>::finished, this, [watcher, this]() {
-        if (!watcher->isCanceled()) {
-            mapImage_ = watcher->result();
-            QRect br = mapImage_.rect();
-            setMinimumSize(br.size());
-            repaint();
+void MapWidget::requestHeightMap()
+{
+    if (!heightMap_.isNull() || heightMapPending_ || !heightMapSource_) {
+        return;
+    }
+    heightMapPending_ = true;
+    QtConcurrent::run(heightMapSource_).then(this, [this, epoch = heightMapEpoch_](QSharedPointer<const HeightMap> heightMap) {
+        if (epoch == heightMapEpoch_) {
+            heightMap_ = heightMap;
+            heightMapPending_ = false;
         }
     });
-    connect(watcher, &QFutureWatcher<QPixmap>::finished, watcher, &QFutureWatcher<QPixmap>::deleteLater);
-    watcher->setFuture(future_);
+}
+
+void MapWidget::setDiff(const QSharedPointer<const SaveDiff>& diff)
+{
+    diff_ = diff;
+    QWidget::update();
+}
+
+void MapWidget::startRender()
+{
+    if (!pending_) {
+        return;
+    }
+    PendingDraw draw = std::move(*pending_);
+    pending_.reset();
+    if (draw.snapshot != snapshot_ && !sameGame(draw.snapshot.data(), snapshot_.data())) {
+        tiles_.clear();
+    }
+    opt_ = draw.opt;
+    snapshot_ = std::move(draw.snapshot);
+    invalidate();
+    setMinimumSize(projection().imageSize());
+    QWidget::update();
+}
+
+void MapWidget::invalidate()
+{
+    ++generation_;
+    cancelTiles();
+}
+
+// Queued renders never start; running ones stop at their next check.
+void MapWidget::cancelTiles()
+{
+    for (QFuture<QImage>& future : inFlight_) {
+        future.cancel();
+    }
+    inFlight_.clear();
+    ++requestEpoch_;
 }
 
 void MapWidget::clear()
 {
-    mapImage_ = QPixmap();
+    invalidate();
+    pending_.reset();
+    redrawTimer_.stop();
+    renderer_->clear();
+    tiles_.clear();
+    snapshot_.reset();
+    setHeightMapSource(nullptr);
+    QToolTip::hideText();
     repaint();
 }
 
+void MapWidget::setLevel(int level)
+{
+    level = std::clamp(level, 0, LevelCount - 1);
+    if (level == level_) {
+        return;
+    }
+    level_ = level;
+    // Tiles of the old level are off screen now.
+    cancelTiles();
+    if (!snapshot_.isNull()) {
+        setMinimumSize(projection().imageSize());
+    }
+    QWidget::update();
+}
+
+void MapWidget::zoomAt(const QPointF& p, int level)
+{
+    QScrollArea* area = scrollArea();
+    const QPointF world = toWorld(p);
+    setLevel(level);
+    // Nothing to scroll when the whole map fits; the widget may not even be resized.
+    const QSize size = projection().imageSize();
+    if (area && !snapshot_.isNull() && (size.width() > area->viewport()->width() || size.height() > area->viewport()->height())) {
+        zoomAnchor_ = ZoomAnchor{ world, area->viewport()->mapFrom(this, p.toPoint()) };
+    } else {
+        zoomAnchor_.reset();
+    }
+}
+
+// Scrolls so that the point under the cursor before a zoom is under it again.
+void MapWidget::applyZoomAnchor()
+{
+    QScrollArea* area = scrollArea();
+    if (!zoomAnchor_ || !area) {
+        return;
+    }
+    const QPoint p = mapTo(area->widget(), toWidget(zoomAnchor_->world).toPoint());
+    area->horizontalScrollBar()->setValue(p.x() - zoomAnchor_->viewport.x());
+    area->verticalScrollBar()->setValue(p.y() - zoomAnchor_->viewport.y());
+    zoomAnchor_.reset();
+}
+
+float MapWidget::scale() const
+{
+    return levelScale(level_);
+}
+
+MapProjection MapWidget::projection() const
+{
+    if (snapshot_.isNull()) {
+        return MapProjection{ scale(), 0, 0 };
+    }
+    return MapProjection::of(*snapshot_, scale());
+}
+
+// Where the map image is in the widget; centred when the widget is larger.
+QRect MapWidget::mapRect() const
+{
+    const QSize size = projection().imageSize();
+    const QRect cr = contentsRect();
+    return QRect(QPoint(qMax(0, (cr.width() - size.width()) / 2), qMax(0, (cr.height() - size.height()) / 2)), size);
+}
+
+QPointF MapWidget::toWidget(const QPointF& world) const
+{
+    return projection().toImage(world.x(), world.y()) + mapRect().topLeft();
+}
+
+QPointF MapWidget::toWorld(const QPointF& p) const
+{
+    return projection().toWorld(p - mapRect().topLeft());
+}
+
+QScrollArea* MapWidget::scrollArea() const
+{
+    for (QWidget* w = parentWidget(); w; w = w->parentWidget()) {
+        if (auto area = qobject_cast<QScrollArea*>(w)) {
+            return area;
+        }
+    }
+    return nullptr;
+}
+
 void MapWidget::mousePressEvent(QMouseEvent* event) {
-    QRect cr = contentsRect();
-    QRect br = mapImage_.rect();
-    int mapWidth = br.width();
-    int mapHeight = br.height();
-    int xo = (cr.width() - mapWidth) / 2;
-    int yo = (cr.height() - mapHeight) / 2;
+    if (event->button() == Qt::MiddleButton) {
+        panning_ = true;
+        panFrom_ = event->globalPosition().toPoint();
+        setCursor(Qt::ClosedHandCursor);
+        return;
+    }
     auto p = event->position();
-    if (p.x() < xo || p.y() < yo || p.x() > xo + mapWidth || p.y() > yo + mapHeight) {
+    if (snapshot_.isNull() || !mapRect().contains(p.toPoint())) {
         return;
     }
-    emit clicked(QPointF((mapWidth - p.x() + xo) * scale_, (p.y() - yo) * scale_));
+    emit clicked(toWorld(p));
 }
 
 void MapWidget::mouseMoveEvent(QMouseEvent *event)
 {
-    if (!highlightMouse_.enabled) {
+    if (panning_) {
+        const QPoint p = event->globalPosition().toPoint();
+        const QPoint d = p - panFrom_;
+        panFrom_ = p;
+        if (QScrollArea* area = scrollArea()) {
+            area->horizontalScrollBar()->setValue(area->horizontalScrollBar()->value() - d.x());
+            area->verticalScrollBar()->setValue(area->verticalScrollBar()->value() - d.y());
+        }
         return;
     }
-    QRect cr = contentsRect();
-    QRect mapRect = mapImage_.rect();
-    int mapWidth = mapRect.width();
-    int mapHeight = mapRect.height();
-    int xo = (cr.width() - mapWidth) / 2;
-    int yo = (cr.height() - mapHeight) / 2;
     QPoint p = event->position().toPoint();
-    if (p.x() < xo || p.y() < yo || p.x() > xo + mapWidth || p.y() > yo + mapHeight) {
+    if (!snapshot_.isNull() && mapRect().contains(p)) {
+        const float radius = HighlightRadius * scale();
+        requestHeightMap();
+        QToolTip::showText(event->globalPosition().toPoint(), inspectMapPoint(*snapshot_, heightMap_.data(), toWorld(event->position()), radius), this);
+    } else {
+        QToolTip::hideText();
+    }
+    if (!highlightMouse_.enabled) {
+        return;
+    }
+    if (!mapRect().contains(p)) {
         if (highlightMouse_.show) {
             widgetUpdate(highlightMouse_.p);
             highlightMouse_.show = false;
@@ -406,8 +313,42 @@ void MapWidget::mouseMoveEvent(QMouseEvent *event)
     widgetUpdate(p);
 }
 
+void MapWidget::mouseReleaseEvent(QMouseEvent* event)
+{
+    if (event->button() == Qt::MiddleButton && panning_) {
+        panning_ = false;
+        unsetCursor();
+    }
+}
+
+void MapWidget::wheelEvent(QWheelEvent* event)
+{
+    if (!(event->modifiers() & Qt::ControlModifier)) {
+        // Let the scroll area scroll.
+        QWidget::wheelEvent(event);
+        return;
+    }
+    event->accept();
+    // Touchpads send fractions of a notch.
+    wheelDelta_ += event->angleDelta().y();
+    const int steps = wheelDelta_ / QWheelEvent::DefaultDeltasPerStep;
+    wheelDelta_ -= steps * QWheelEvent::DefaultDeltasPerStep;
+    if (steps != 0) {
+        zoomAt(event->position(), level_ + steps);
+    }
+}
+
+void MapWidget::resizeEvent(QResizeEvent* /*event*/)
+{
+    // The scroll area resizes us before it updates its scroll bar ranges.
+    if (zoomAnchor_) {
+        QTimer::singleShot(0, this, &MapWidget::applyZoomAnchor);
+    }
+}
+
 void MapWidget::leaveEvent(QEvent* /*event*/)
 {
+    QToolTip::hideText();
     if (!highlightMouse_.enabled) {
         return;
     }
@@ -418,51 +359,159 @@ void MapWidget::leaveEvent(QEvent* /*event*/)
 
 void MapWidget::paintEvent(QPaintEvent *event)
 {
-    QRect cr = contentsRect();
-    QRect mapRect = mapImage_.rect();
-    int mapWidth = mapRect.width();
-    int mapHeight = mapRect.height();
-    int xo = (cr.width() - mapWidth) / 2;
-    int yo = (cr.height() - mapHeight) / 2;
-
     QPainter painter(this);
-    QRect dirtyRect = event->rect();
-
-    int dirtyLeft = 0;
-    int mapLeft = 0;
-    int w = calcRectCoordinate(dirtyRect.left(), dirtyRect.width(), xo, mapWidth, dirtyLeft, mapLeft);
-    if (w == 0) {
-        return;
+    if (!snapshot_.isNull()) {
+        const QRect map = mapRect();
+        const QRect dirty = (event->rect() & map).translated(-map.topLeft());
+        if (!dirty.isEmpty()) {
+            painter.save();
+            painter.translate(map.topLeft());
+            painter.setClipRect(dirty);
+            for (int y = dirty.top() / TileSize; y <= dirty.bottom() / TileSize; ++y) {
+                for (int x = dirty.left() / TileSize; x <= dirty.right() / TileSize; ++x) {
+                    drawTile(painter, x, y);
+                }
+            }
+            painter.restore();
+        }
     }
-    dirtyRect.setX(dirtyLeft);
-    dirtyRect.setWidth(w);
-    mapRect.setX(mapLeft);
-    mapRect.setWidth(w);
-
-    int dirtyTop = 0;
-    int mapTop = 0;
-    int h = calcRectCoordinate(dirtyRect.top(), dirtyRect.height(), yo, mapHeight, dirtyTop, mapTop);
-    if (h == 0) {
-        return;
+    if (!diff_.isNull()) {
+        drawDiff(painter, event->rect());
     }
-    dirtyRect.setY(dirtyTop);
-    dirtyRect.setHeight(h);
-    mapRect.setY(mapTop);
-    mapRect.setHeight(h);
-
-    painter.drawPixmap(dirtyRect, mapImage_, mapRect);
     painter.setPen(Qt::black);
     painter.setBrush(Qt::transparent);
     if (highlightMouse_.show) {
         painter.drawEllipse(highlightMouse_.p.x() - HighlightRadius, highlightMouse_.p.y() - HighlightRadius, HighlightRadius * 2, HighlightRadius * 2);
     }
-    for (const QPoint& p : highlight_) {
-        painter.drawEllipse(xo + p.x() - HighlightRadius, yo + p.y() - HighlightRadius, HighlightRadius * 2, HighlightRadius * 2);
+    for (const QPointF& world : highlight_) {
+        const QPointF p = toWidget(world);
+        painter.drawEllipse(p, HighlightRadius, HighlightRadius);
+    }
+}
+
+// Marks the diff entries in `area`: green rings for new entities, red crosses for gone ones, orange
+// and cyan rings for minerals and forageables that shrank or grew, and a line from where an animal
+// or raider was.
+void MapWidget::drawDiff(QPainter& painter, const QRect& area)
+{
+    constexpr int r = 6;
+    const QRect visible = area.adjusted(-r - 1, -r - 1, r + 1, r + 1);
+    painter.save();
+    painter.setBrush(Qt::NoBrush);
+    for (const EntityDiff& d : diff_->entries) {
+        const QPointF to = toWidget(QPointF(d.to.x, d.to.z));
+        const QPointF from = toWidget(QPointF(d.from.x, d.from.z));
+        if (!visible.contains(to.toPoint()) && (d.change != EntityDiff::Moved || !visible.contains(from.toPoint()))) {
+            continue;
+        }
+        switch (d.change) {
+        case EntityDiff::Added:
+            painter.setPen(QPen(Qt::green, 2));
+            painter.drawEllipse(to, r, r);
+            break;
+        case EntityDiff::Removed:
+            painter.setPen(QPen(Qt::red, 2));
+            painter.drawLine(to + QPointF(-r, -r), to + QPointF(r, r));
+            painter.drawLine(to + QPointF(-r, r), to + QPointF(r, -r));
+            break;
+        case EntityDiff::Moved:
+            painter.setPen(QPen(Qt::darkGray, 1, Qt::DashLine));
+            painter.drawLine(from, to);
+            painter.setPen(QPen(Qt::darkGray, 2));
+            painter.drawEllipse(to, r / 2, r / 2);
+            break;
+        case EntityDiff::AmountChanged:
+            painter.setPen(QPen(d.newAmount < d.oldAmount ? QColor(255, 128, 0) : Qt::cyan, 2));
+            painter.drawEllipse(to, r, r);
+            break;
+        }
+    }
+    painter.restore();
+}
+
+// Draws tile (x, y) of the current level; the painter is in map image coordinates.
+void MapWidget::drawTile(QPainter& painter, int x, int y)
+{
+    const Tile* tile = tiles_.object(tileKey(level_, x, y));
+    if (tile && tile->generation == generation_) {
+        if (!tile->complete) {
+            requestTile(x, y);
+        }
+        painter.drawImage(x * TileSize, y * TileSize, tile->image);
+        return;
+    }
+    requestTile(x, y);
+    painter.fillRect(QRect(x * TileSize, y * TileSize, TileSize, TileSize), Qt::white);
+    if (tile) {
+        painter.drawImage(x * TileSize, y * TileSize, tile->image);
+        return;
+    }
+    for (int level = level_ - 1; level >= 0; --level) {
+        const int shift = level_ - level;
+        if (drawCachedTile(painter, level, x >> shift, y >> shift)) {
+            return;
+        }
+    }
+    if (level_ + 1 < LevelCount) {
+        for (int i = 0; i < 4; ++i) {
+            drawCachedTile(painter, level_ + 1, x * 2 + i % 2, y * 2 + i / 2);
+        }
+    }
+}
+
+// Draws a cached tile of another level scaled to the current one, if there is one.
+bool MapWidget::drawCachedTile(QPainter& painter, int level, int x, int y)
+{
+    const Tile* tile = tiles_.object(tileKey(level, x, y));
+    if (!tile) {
+        return false;
     }
+    const qreal k = levelScale(level) / scale();
+    painter.drawImage(QRectF(x * TileSize * k, y * TileSize * k, tile->image.width() * k, tile->image.height() * k), tile->image);
+    return true;
+}
+
+void MapWidget::requestTile(int x, int y)
+{
+    const int level = level_;
+    const quint64 key = tileKey(level, x, y);
+    if (inFlight_.contains(key)) {
+        return;
+    }
+    const QRect rect = QRect(x * TileSize, y * TileSize, TileSize, TileSize) & QRect(QPoint(), projection().imageSize());
+    QFuture<QImage> future = QtConcurrent::run([renderer = renderer_, opt = opt_, snapshot = snapshot_, scale = scale(), rect](QPromise<QImage>& promise) {
+        renderer->renderTile(promise, opt, snapshot, scale, rect);
+    });
+    inFlight_.insert(key, future);
+    auto watcher = new QFutureWatcher<QImage>(this);
+
+    // The terrain comes first, the finished tile last.
+    connect(watcher, &QFutureWatcher<QImage>::resultReadyAt, this, [watcher, this, key, level, rect, epoch = requestEpoch_](int index) {
+        if (epoch != requestEpoch_) {
+            return;
+        }
+        QImage image = watcher->resultAt(index);
+        const qsizetype cost = qMax<qsizetype>(1, image.sizeInBytes() / 1024);
+        tiles_.insert(key, new Tile{ std::move(image), generation_, false }, cost);
+        if (level == level_) {
+            QWidget::update(rect.translated(mapRect().topLeft()));
+        }
+    });
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [watcher, this, key, epoch = requestEpoch_]() {
+        if (epoch != requestEpoch_) {
+            return;
+        }
+        inFlight_.remove(key);
+        Tile* tile = tiles_.object(key);
+        if (!watcher->isCanceled() && tile && tile->generation == generation_) {
+            tile->complete = true;
+        }
+    });
+    connect(watcher, &QFutureWatcher<QImage>::finished, watcher, &QFutureWatcher<QImage>::deleteLater);
+    watcher->setFuture(future);
 }
 
 void MapWidget::widgetUpdate(const QPoint& p)
 {
     QWidget::update(QRect(p, p).adjusted(-HighlightRect, -HighlightRect, HighlightRect, HighlightRect));
 }
-
@@ -2,10 +2,27 @@
 #define MAPWIDGET_H
 
 #include <QWidget>
+#include <QCache>
+#include <QFuture>
+#include <QHash>
 #include <QSharedPointer>
+#include <QTimer>
 
-class GameMap;
+#include <functional>
+#include <optional>
 
+#include "MapRenderer.h"
+
+class QScrollArea;
+struct HeightMap;
+struct SaveDiff;
+
+// Shows the map as tiles of a multi-resolution pyramid: only visible tiles of the current zoom
+// level are rendered, in the background, and kept in an LRU cache under a memory budget. Until a
+// tile arrives its area shows what the cache has: the outdated tile, or a coarser or finer level.
+// Ctrl+wheel zooms around the cursor, dragging with the middle button pans. Hovering the map
+// shows what is under the cursor in a tooltip, with the terrain height once the height grid,
+// decoded in the background on the first hover, is there. A SaveDiff can be marked over the map.
 class MapWidget : public QWidget
 {
     Q_OBJECT
@@ -13,35 +30,16 @@ public:
     explicit MapWidget(QWidget *parent = nullptr);
     ~MapWidget();
 
-    struct DrawOptions
-    {
-        bool sand = false;
-        bool clay = false;
-        bool coal = false;
-        bool iron = false;
-        bool gold = false;
-        bool stone = false;
-
-        bool greens = false;
-        bool herbs = false;
-        bool roots = false;
-        bool willow = false;
-
-        bool animals = false;
-        bool animalsSpawns = false;
-        bool enemies = false;
-        bool buildings = false;
-
-        uint fertility = 0;
-        uint fodder = 0;
-        uint water = 0;
-    };
-
     void setScale(float v);
     void setHighlightMouse(bool v);
     void addHighlight(const QPoint& position);
     void resetHighlight();
-    void update(const DrawOptions& opt, const QSharedPointer<GameMap>& map);
+    void update(const DrawOptions& opt, const QSharedPointer<const GameMapSnapshot>& snapshot);
+    using HeightMapSource = std::function<QSharedPointer<const HeightMap>()>;
+    // Called on the thread pool the first time the map is hovered.
+    void setHeightMapSource(HeightMapSource source);
+    // What changed since an earlier save; null to remove the marks.
+    void setDiff(const QSharedPointer<const SaveDiff>& diff);
     void clear();
 
 signals:
@@ -50,15 +48,76 @@ signals:
 protected:
     void mousePressEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent* event) override;
+    void mouseReleaseEvent(QMouseEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
     void leaveEvent(QEvent *event) override;
     void paintEvent(QPaintEvent *event) override;
 
 private:
     void widgetUpdate(const QPoint& p);
+    void startRender();
+    void invalidate();
+    void cancelTiles();
+    void setLevel(int level);
+    void zoomAt(const QPointF& p, int level);
+    void applyZoomAnchor();
+    float scale() const;
+    MapProjection projection() const;
+    QRect mapRect() const;
+    QPointF toWidget(const QPointF& world) const;
+    QPointF toWorld(const QPointF& p) const;
+    QScrollArea* scrollArea() const;
+    void drawTile(QPainter& painter, int x, int y);
+    bool drawCachedTile(QPainter& painter, int level, int x, int y);
+    void drawDiff(QPainter& painter, const QRect& area);
+    void requestTile(int x, int y);
+    void requestHeightMap();
+
+    struct PendingDraw
+    {
+        DrawOptions opt;
+        QSharedPointer<const GameMapSnapshot> snapshot;
+    };
+
+    struct Tile
+    {
+        QImage image;
+        int generation;
+        // False while only the terrain is drawn.
+        bool complete;
+    };
+
+    struct ZoomAnchor
+    {
+        QPointF world;
+        QPoint viewport;
+    };
 
-    QFuture<QPixmap> future_;
-    QPixmap mapImage_;
-    float scale_;
+    QSharedPointer<MapRenderer> renderer_;
+    std::optional<PendingDraw> pending_;
+    QTimer redrawTimer_;
+    DrawOptions opt_;
+    QSharedPointer<const GameMapSnapshot> snapshot_;
+    QSharedPointer<const HeightMap> heightMap_;
+    HeightMapSource heightMapSource_;
+    bool heightMapPending_ = false;
+    // Bumped with every source, so heights decoded for an earlier one are dropped.
+    int heightMapEpoch_ = 0;
+    QSharedPointer<const SaveDiff> diff_;
+    // Bumped whenever the options or the snapshot change, so tiles rendered for the previous ones
+    // are only shown until their replacement arrives.
+    int generation_ = 0;
+    QCache<quint64, Tile> tiles_;
+    // Tile renders still running, canceled together whenever their results become useless;
+    // requestEpoch_ tells the results of canceled ones apart from those of later requests.
+    QHash<quint64, QFuture<QImage>> inFlight_;
+    int requestEpoch_ = 0;
+    int level_;
+    int wheelDelta_ = 0;
+    std::optional<ZoomAnchor> zoomAnchor_;
+    bool panning_ = false;
+    QPoint panFrom_;
 
     struct HighlightMouse {
         bool enabled = false;
@@ -66,7 +125,7 @@ private:
         QPoint p;
     };
     HighlightMouse highlightMouse_;
-    std::vector<QPoint> highlight_;
+    std::vector<QPointF> highlight_;
 };
 
 #endif // MAPWIDGET_H
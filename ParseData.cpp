@@ -10,8 +10,10 @@
 
 #include "stdafx.h"
 #include "ParseData.h"
+#include "ByteCursor.h"
+#include "StaticHash.h"
 
-const std::unordered_map<uint, BaseType> BaseTypeById = {
+constexpr StaticHash::Entry<std::uint32_t, BaseType> BaseTypeEntries[] = {
     {  272625919, BaseType::FoWSystem              },
     {  274602495, BaseType::MineralManager         },
     {  482861567, BaseType::Deer                   },
@@ -33,67 +35,79 @@ const std::unordered_map<uint, BaseType> BaseTypeById = {
     { 4058971987, BaseType::BuildingBuildSiteGuids }
 };
 
+constexpr auto BaseTypeById = StaticHash::makeTable(BaseTypeEntries);
+
 BaseType parseBaseType(uint id) {
-    auto i = BaseTypeById.find(id);
-    if (i == BaseTypeById.end()) {
-        return BaseType::Unknown;
+    return BaseTypeById.value(id, BaseType::Unknown);
+}
+
+uint baseTypeId(BaseType type)
+{
+    for (const auto& i : BaseTypeEntries) {
+        if (i.value == type) {
+            return i.key;
+        }
     }
-    return i->second;
+    return 0;
 }
 
-const std::unordered_map<QByteArray, BaseType> AnimalsSpawnTypeByUUID = {
-    {  "7361af1e-8897-4099-b372-dfe646d10328", BaseType::Bear    }, // Bear_Hard
-    {  "ac4a8fd7-b9cb-44e4-be78-105e11c07bd1", BaseType::Bear    }, // Bear_Normal
-    {  "621e052e-99cb-483f-8cd8-6f0612e6d32c", BaseType::Bear    }, // Bear_VeryHard
+constexpr StaticHash::Entry<StaticHash::Uuid, BaseType> AnimalsSpawnTypeEntries[] = {
+    { StaticHash::uuid("7361af1e-8897-4099-b372-dfe646d10328"), BaseType::Bear    }, // Bear_Hard
+    { StaticHash::uuid("ac4a8fd7-b9cb-44e4-be78-105e11c07bd1"), BaseType::Bear    }, // Bear_Normal
+    { StaticHash::uuid("621e052e-99cb-483f-8cd8-6f0612e6d32c"), BaseType::Bear    }, // Bear_VeryHard
 
-    {  "ad9b2d3d-30fb-49a8-a688-724ec2dd3c1d", BaseType::Boar    }, // Boar_Easy
-    {  "f0e7a583-81bc-4efe-8723-d5f3a602420d", BaseType::Boar    }, // Boar_Hard
-    {  "9347bbe9-23eb-4f2a-90ab-f9620a2d8665", BaseType::Boar    }, // Boar_Normal
-    {  "037681cb-0f6a-4431-bd1d-a62f629bad73", BaseType::Boar    }, // Boar_VeryHard
+    { StaticHash::uuid("ad9b2d3d-30fb-49a8-a688-724ec2dd3c1d"), BaseType::Boar    }, // Boar_Easy
+    { StaticHash::uuid("f0e7a583-81bc-4efe-8723-d5f3a602420d"), BaseType::Boar    }, // Boar_Hard
+    { StaticHash::uuid("9347bbe9-23eb-4f2a-90ab-f9620a2d8665"), BaseType::Boar    }, // Boar_Normal
+    { StaticHash::uuid("037681cb-0f6a-4431-bd1d-a62f629bad73"), BaseType::Boar    }, // Boar_VeryHard
 
-    {  "b4849983-c710-48e9-9d47-93f65369640b", BaseType::Deer    }, // Deer_Easy
-    {  "6b4c3a15-9875-467e-83da-c9dc121fae87", BaseType::Deer    }, // Deer_Hard
-    {  "1b89ffdd-78ca-4dc0-bbd4-cd81cda57fe1", BaseType::Deer    }, // Deer_Normal
-    {  "9f9d0ef7-becd-4ddd-b219-2cc3898d930e", BaseType::Deer    }, // Deer_VeryHard
+    { StaticHash::uuid("b4849983-c710-48e9-9d47-93f65369640b"), BaseType::Deer    }, // Deer_Easy
+    { StaticHash::uuid("6b4c3a15-9875-467e-83da-c9dc121fae87"), BaseType::Deer    }, // Deer_Hard
+    { StaticHash::uuid("1b89ffdd-78ca-4dc0-bbd4-cd81cda57fe1"), BaseType::Deer    }, // Deer_Normal
+    { StaticHash::uuid("9f9d0ef7-becd-4ddd-b219-2cc3898d930e"), BaseType::Deer    }, // Deer_VeryHard
 
-    {  "301d292d-b239-45fe-a021-83e1a08f1d69", BaseType::Wolf    }, // Wolf_Hard
-    {  "2fb21f39-f10a-43f2-80f2-cde6e225ef6e", BaseType::Wolf    }, // Wolf_Hard_Roaming
-    {  "43c882e6-a835-4a85-a028-186c8a53e855", BaseType::Wolf    }, // Wolf_Normal
-    {  "ef151ac7-4e23-4687-95a5-bb9cd76eb28a", BaseType::Wolf    }, // Wolf_VeryHard
-    {  "c8ec56cb-e421-4d59-90cd-513dfe95d1a2", BaseType::Wolf    }  // Wolf_VeryHard_Roaming
+    { StaticHash::uuid("301d292d-b239-45fe-a021-83e1a08f1d69"), BaseType::Wolf    }, // Wolf_Hard
+    { StaticHash::uuid("2fb21f39-f10a-43f2-80f2-cde6e225ef6e"), BaseType::Wolf    }, // Wolf_Hard_Roaming
+    { StaticHash::uuid("43c882e6-a835-4a85-a028-186c8a53e855"), BaseType::Wolf    }, // Wolf_Normal
+    { StaticHash::uuid("ef151ac7-4e23-4687-95a5-bb9cd76eb28a"), BaseType::Wolf    }, // Wolf_VeryHard
+    { StaticHash::uuid("c8ec56cb-e421-4d59-90cd-513dfe95d1a2"), BaseType::Wolf    }  // Wolf_VeryHard_Roaming
 };
 
-BaseType parseAnimalsSpawnType(const QByteArray &uuid) {
-    auto i = AnimalsSpawnTypeByUUID.find(uuid);
-    if (i == AnimalsSpawnTypeByUUID.end()) {
+constexpr auto AnimalsSpawnTypeByUUID = StaticHash::makeTable(AnimalsSpawnTypeEntries);
+
+BaseType parseAnimalsSpawnType(QByteArrayView uuid) {
+    StaticHash::Uuid key;
+    if (!StaticHash::parseUuid(std::string_view(uuid.data(), uuid.size()), key)) {
         return BaseType::Unknown;
     }
-    return i->second;
+    return AnimalsSpawnTypeByUUID.value(key, BaseType::Unknown);
 }
 
-const std::unordered_map<QByteArray, RaiderType> RaiderTypeByUUID = {
-    {  "7b8e2ab8-2511-4b09-b2a3-7d020d200654", RaiderType::Thief           }, // RaiderUnit_Thief
-    {  "f7eb7176-4b2d-450b-b991-aa4854de3b70", RaiderType::Brawler         }, // RaiderUnit_Brawler_Male
-    {  "e2f3921a-a92c-4eef-9b80-1d4990d53d96", RaiderType::Brawler         }, // RaiderUnit_Brawler_Female
-    {  "d46bd838-4635-4248-917b-a8bb8df8bbc2", RaiderType::Warrior         }, // RaiderUnit_Warrior_Male
-    {  "8937422c-1758-4903-8760-8a559515dfa7", RaiderType::Warrior         }, // RaiderUnit_Warrior_Female
-    {  "1c6eff9d-3d70-4758-8688-b0184883c41a", RaiderType::Shieldbearer    }, // RaiderUnit_Elite
-    {  "2c5eff88-1435-43a7-9542-5cbbe7e223eb", RaiderType::Warmaster       }, // RaiderUnit_Champion
+constexpr StaticHash::Entry<StaticHash::Uuid, RaiderType> RaiderTypeEntries[] = {
+    { StaticHash::uuid("7b8e2ab8-2511-4b09-b2a3-7d020d200654"), RaiderType::Thief           }, // RaiderUnit_Thief
+    { StaticHash::uuid("f7eb7176-4b2d-450b-b991-aa4854de3b70"), RaiderType::Brawler         }, // RaiderUnit_Brawler_Male
+    { StaticHash::uuid("e2f3921a-a92c-4eef-9b80-1d4990d53d96"), RaiderType::Brawler         }, // RaiderUnit_Brawler_Female
+    { StaticHash::uuid("d46bd838-4635-4248-917b-a8bb8df8bbc2"), RaiderType::Warrior         }, // RaiderUnit_Warrior_Male
+    { StaticHash::uuid("8937422c-1758-4903-8760-8a559515dfa7"), RaiderType::Warrior         }, // RaiderUnit_Warrior_Female
+    { StaticHash::uuid("1c6eff9d-3d70-4758-8688-b0184883c41a"), RaiderType::Shieldbearer    }, // RaiderUnit_Elite
+    { StaticHash::uuid("2c5eff88-1435-43a7-9542-5cbbe7e223eb"), RaiderType::Warmaster       }, // RaiderUnit_Champion
 
-    {  "93fc8b22-7dcf-4103-a5b8-7fe0d86fd46b", RaiderType::Arbalest        }, // InvaderUnit_Arbalest
-    {  "96238dda-f6f4-4c5e-b8fb-923332194bcd", RaiderType::Champion        }, // InvaderUnit_Champion
-    {  "ba493164-2dc4-45f6-9560-5d35e7c4e4bf", RaiderType::Footman         }, // InvaderUnit_Footman
-    {  "83a57f3d-37d5-45f0-9b20-ad55603a27ac", RaiderType::HeavyInfantry   }  // InvaderUnit_HeavyInfantry
+    { StaticHash::uuid("93fc8b22-7dcf-4103-a5b8-7fe0d86fd46b"), RaiderType::Arbalest        }, // InvaderUnit_Arbalest
+    { StaticHash::uuid("96238dda-f6f4-4c5e-b8fb-923332194bcd"), RaiderType::Champion        }, // InvaderUnit_Champion
+    { StaticHash::uuid("ba493164-2dc4-45f6-9560-5d35e7c4e4bf"), RaiderType::Footman         }, // InvaderUnit_Footman
+    { StaticHash::uuid("83a57f3d-37d5-45f0-9b20-ad55603a27ac"), RaiderType::HeavyInfantry   }  // InvaderUnit_HeavyInfantry
 
 };
 
 
-RaiderType parseRaiderType(const QByteArray &uuid) {
-    auto i = RaiderTypeByUUID.find(uuid);
-    if (i == RaiderTypeByUUID.end()) {
+constexpr auto RaiderTypeByUUID = StaticHash::makeTable(RaiderTypeEntries);
+
+RaiderType parseRaiderType(QByteArrayView uuid) {
+    StaticHash::Uuid key;
+    if (!StaticHash::parseUuid(std::string_view(uuid.data(), uuid.size()), key)) {
         return RaiderType::Unknown;
     }
-    return i->second;
+    return RaiderTypeByUUID.value(key, RaiderType::Unknown);
 }
 
 MineralType parseMineralType(quint32 v)
@@ -125,7 +139,7 @@ uint mineralTypeId(MineralType type)
 }
 
 
-const std::unordered_map<QByteArray, GameItem> GameItemByText = {
+constexpr StaticHash::Entry<std::string_view, GameItem> GameItemEntries[] = {
     {  "ItemLogs", GameItem::Logs         },
     {  "ItemBerries", GameItem::Berries         },
     {  "ItemStone", GameItem::Stone         },
@@ -205,19 +219,190 @@ const std::unordered_map<QByteArray, GameItem> GameItemByText = {
     {  "ItemBoarCarcass", GameItem::BoarCarcass         }
 };
 
-GameItem parseItem(const QByteArray& v)
+constexpr auto GameItemByText = StaticHash::makeTable(GameItemEntries);
+
+GameItem parseItem(QByteArrayView v)
+{
+    return GameItemByText.value(std::string_view(v.data(), v.size()), GameItem::Unknown);
+}
+
+QLatin1String mineralStr(MineralType v)
 {
-    auto i = GameItemByText.find(v);
-    if (i == GameItemByText.end()) {
-        return GameItem::Unknown;
+    switch (v)
+    {
+    case MineralType::Iron:
+        return QLatin1String("Iron");
+    case MineralType::Gold:
+        return QLatin1String("Gold");
+    case MineralType::Coal:
+        return QLatin1String("Coal");
+    case MineralType::Clay:
+        return QLatin1String("Clay");
+    case MineralType::Sand:
+        return QLatin1String("Sand");
+    case MineralType::Stone:
+        return QLatin1String("Stone");
+    default:
+        break;
+    }
+    return QLatin1String("Unknown");
+}
+
+QLatin1String itemStr(GameItem v)
+{
+    switch (v)
+    {
+    case GameItem::Greens:
+        return QLatin1String("Greens");
+    case GameItem::Herbs:
+        return QLatin1String("Herbs");
+    case GameItem::Roots:
+        return QLatin1String("Roots");
+    case GameItem::Willow:
+        return QLatin1String("Willow");
+    default:
+        break;
     }
-    return i->second;
+    return QLatin1String("Other");
 }
 
-QDataStream& operator>>(QDataStream& in, Point& rhs) {
-    in >> rhs.x;
-    in >> rhs.y;
-    in >> rhs.z;
+QLatin1String baseStr(BaseType v)
+{
+    switch (v)
+    {
+    case BaseType::Bear:
+        return QLatin1String("Bear");
+    case BaseType::Boar:
+        return QLatin1String("Boar");
+    case BaseType::Deer:
+        return QLatin1String("Deer");
+    case BaseType::Wolf:
+        return QLatin1String("Wolf");
+    case BaseType::WolfDen:
+        return QLatin1String("Wolf Den");
+    case BaseType::Shelter:
+        return QLatin1String("Shelter");
+    case BaseType::TownCenter:
+        return QLatin1String("Town Center");
+    default:
+        break;
+    }
+    return QLatin1String("Other");
+}
+
+QLatin1String raiderStr(RaiderType v)
+{
+    switch (v)
+    {
+    case RaiderType::Thief:
+        return QLatin1String("Thief");
+    case RaiderType::Brawler:
+        return QLatin1String("Brawler");
+    case RaiderType::Warrior:
+        return QLatin1String("Warrior");
+    case RaiderType::Shieldbearer:
+        return QLatin1String("Shieldbearer");
+    case RaiderType::Warmaster:
+        return QLatin1String("Warmaster");
+    case RaiderType::Arbalest:
+        return QLatin1String("Arbalest");
+    case RaiderType::Champion:
+        return QLatin1String("Champion");
+    case RaiderType::Footman:
+        return QLatin1String("Footman");
+    case RaiderType::HeavyInfantry:
+        return QLatin1String("Heavy Infantry");
+    case RaiderType::BatteringRam:
+        return QLatin1String("Battering Ram");
+    default:
+        break;
+    }
+    return QLatin1String("Unknown");
+}
+
+void deinterleaveFloats(const uchar* src, size_t count, uint fields, float* const* dst)
+{
+    size_t i = 0;
+#if FF_SIMD_SSE2 && Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    const size_t recordSize = size_t(fields) * sizeof(float);
+    for (; i + 4 <= count; i += 4) {
+        const float* r0 = reinterpret_cast<const float*>(src + i * recordSize);
+        const float* r1 = reinterpret_cast<const float*>(src + (i + 1) * recordSize);
+        const float* r2 = reinterpret_cast<const float*>(src + (i + 2) * recordSize);
+        const float* r3 = reinterpret_cast<const float*>(src + (i + 3) * recordSize);
+        uint f = 0;
+        for (; f + 4 <= fields; f += 4) {
+            __m128 a = _mm_loadu_ps(r0 + f);
+            __m128 b = _mm_loadu_ps(r1 + f);
+            __m128 c = _mm_loadu_ps(r2 + f);
+            __m128 d = _mm_loadu_ps(r3 + f);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+            _mm_storeu_ps(dst[f] + i, a);
+            _mm_storeu_ps(dst[f + 1] + i, b);
+            _mm_storeu_ps(dst[f + 2] + i, c);
+            _mm_storeu_ps(dst[f + 3] + i, d);
+        }
+        if (f + 2 <= fields) {
+            // 64-bit loads keep the last pair of fields inside the record.
+            __m128 lo = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(r0 + f)), reinterpret_cast<const __m64*>(r1 + f));
+            __m128 hi = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(r2 + f)), reinterpret_cast<const __m64*>(r3 + f));
+            _mm_storeu_ps(dst[f] + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(dst[f + 1] + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+            f += 2;
+        }
+        for (; f < fields; ++f) {
+            dst[f][i] = qFromLittleEndian<float>(r0 + f);
+            dst[f][i + 1] = qFromLittleEndian<float>(r1 + f);
+            dst[f][i + 2] = qFromLittleEndian<float>(r2 + f);
+            dst[f][i + 3] = qFromLittleEndian<float>(r3 + f);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        const uchar* record = src + i * fields * sizeof(float);
+        for (uint f = 0; f < fields; ++f) {
+            dst[f][i] = qFromLittleEndian<float>(record + f * sizeof(float));
+        }
+    }
+}
+
+GeneralSaveData parseGeneralSaveData(ByteCursor& in, QByteArrayView* landscape)
+{
+    GeneralSaveData r;
+    in.skip(5);
+    r.version = in.readArray<quint8>("version").toByteArray();
+    r.seed = in.readArray<quint8>("seed").toByteArray();
+    r.v1 = in.read<quint8>();
+    r.v2 = in.read<quint8>();
+    r.wildlifeDifficulty = in.read<quint8>();
+    r.raidersDifficulty = in.read<quint8>();
+    r.pacifist = in.read<quint8>();
+    r.name = in.readArray<quint8>("name").toByteArray();
+    r.villagers = in.read<quint32>();
+    r.years = in.read<quint32>();
+    r.v3 = in.read<quint32>();
+    r.v4 = in.read<quint32>();
+    r.timestamp = in.read<quint32>();
+    r.hours = in.read<quint32>();
+    r.mins = in.read<quint32>();
+    const QByteArrayView png = in.readArray<quint32>("landscape");
+    if (landscape != nullptr) {
+        *landscape = png;
+    }
+    return r;
+}
+
+QDataStream& operator<<(QDataStream& out, const GeneralSaveData& rhs)
+{
+    out << rhs.seed << rhs.version << rhs.name << rhs.villagers << rhs.years << rhs.v1 << rhs.v2 << rhs.v3 << rhs.v4
+        << rhs.timestamp << rhs.hours << rhs.mins << rhs.wildlifeDifficulty << rhs.raidersDifficulty << rhs.pacifist;
+    return out;
+}
+
+QDataStream& operator>>(QDataStream& in, GeneralSaveData& rhs)
+{
+    in >> rhs.seed >> rhs.version >> rhs.name >> rhs.villagers >> rhs.years >> rhs.v1 >> rhs.v2 >> rhs.v3 >> rhs.v4
+        >> rhs.timestamp >> rhs.hours >> rhs.mins >> rhs.wildlifeDifficulty >> rhs.raidersDifficulty >> rhs.pacifist;
     return in;
 }
 
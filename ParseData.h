@@ -2,27 +2,83 @@
 #define PARSEDATA_H
 
 #include <QByteArray>
+#include <QString>
+#include <QtEndian>
+
+#include <type_traits>
+
 #include "DataDefines.h"
 
+class ByteCursor;
+
 BaseType parseBaseType(uint id);
-BaseType parseAnimalsSpawnType(const QByteArray& uuid);
-RaiderType parseRaiderType(const QByteArray& uuid);
+uint baseTypeId(BaseType type);
+BaseType parseAnimalsSpawnType(QByteArrayView uuid);
+RaiderType parseRaiderType(QByteArrayView uuid);
 MineralType parseMineralType(quint32 v);
 uint mineralTypeId(MineralType type);
-GameItem parseItem(const QByteArray& v);
+GameItem parseItem(QByteArrayView v);
+// Display names, shown in the UI and used as keys of the batch stats.
+QLatin1String mineralStr(MineralType v);
+QLatin1String itemStr(GameItem v);
+QLatin1String baseStr(BaseType v);
+QLatin1String raiderStr(RaiderType v);
 
-template<class T>
-QByteArray readArray(QDataStream& in)
+// A field of a save as laid out in the file: componentType, name (quint8 length + bytes), fieldSize,
+// id, then fieldSize - 4 bytes of payload. Offsets are from the start of the save.
+struct SaveRecord
 {
-    T size;
-    in >> size;
-    QByteArray r;
-    r.resize(size);
-    in.readRawData(r.data(), size);
-    return r;
+    qint64 begin;
+    qint64 headerSize;
+    quint32 id;
+    qint64 fieldBegin;
+    qint64 fieldSize;
+};
+
+// Calls f(record) for every complete record of `save`, stopping early if f returns false, and
+// returns where the walk stopped. Only the headers are read.
+template<class F>
+qint64 forEachSaveRecord(QByteArrayView save, F f)
+{
+    const uchar* data = reinterpret_cast<const uchar*>(save.data());
+    const qint64 size = save.size();
+    qint64 pos = 0;
+    while (pos + 2 <= size) {
+        SaveRecord r;
+        r.begin = pos;
+        pos += 2 + data[pos + 1];
+        r.headerSize = pos - r.begin;
+        if (pos + 8 > size) {
+            break;
+        }
+        const quint32 fieldSize = qFromLittleEndian<quint32>(data + pos);
+        r.id = qFromLittleEndian<quint32>(data + pos + 4);
+        if (fieldSize < 4 || fieldSize - 4 > size - pos - 8) {
+            break;
+        }
+        r.fieldBegin = pos + 8;
+        r.fieldSize = fieldSize - 4;
+        pos = r.fieldBegin + r.fieldSize;
+        if constexpr (std::is_same_v<decltype(f(r)), bool>) {
+            if (!f(r)) {
+                break;
+            }
+        } else {
+            f(r);
+        }
+    }
+    return pos;
 }
 
-QDataStream& operator>>(QDataStream& in, Point& rhs);
+// Splits `count` records of `fields` interleaved little-endian floats into one array per field.
+void deinterleaveFloats(const uchar* src, size_t count, uint fields, float* const* dst);
+
+// Decodes a MetaData field payload. The embedded PNG of the landscape goes to `landscape`, if any,
+// as a view into the payload.
+GeneralSaveData parseGeneralSaveData(ByteCursor& in, QByteArrayView* landscape = nullptr);
+
 QDataStream& operator<<(QDataStream& out, const Point& rhs);
+QDataStream& operator<<(QDataStream& out, const GeneralSaveData& rhs);
+QDataStream& operator>>(QDataStream& in, GeneralSaveData& rhs);
 
 #endif // PARSEDATA_H
@@ -0,0 +1,65 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "SaveBrowser.h"
+#include "ui_SaveBrowser.h"
+#include "SaveCatalog.h"
+
+SaveBrowser::SaveBrowser(SaveCatalog& catalog, QWidget* parent)
+    : QDialog(parent)
+    , ui(new Ui::SaveBrowser)
+    , catalog_(catalog)
+{
+    ui->setupUi(this);
+    connect(&catalog_, &SaveCatalog::updated, this, &SaveBrowser::fill);
+    fill();
+    catalog_.refresh();
+}
+
+SaveBrowser::~SaveBrowser()
+{
+    delete ui;
+}
+
+QString SaveBrowser::selectedPath() const
+{
+    const QListWidgetItem* item = ui->listWidgetSaves->currentItem();
+    return item != nullptr ? item->data(Qt::UserRole).toString() : QString();
+}
+
+void SaveBrowser::fill()
+{
+    const QString selected = selectedPath();
+    QListWidget* list = ui->listWidgetSaves;
+    list->setUpdatesEnabled(false);
+    list->clear();
+    QLocale loc(QLocale::English);
+    for (const SaveInfo& s : catalog_.saves()) {
+        const GeneralSaveData& d = s.data;
+        auto item = new QListWidgetItem(QString("%1\nyear %2, %3 villagers").arg(d.name).arg(d.years).arg(d.villagers), list);
+        if (!s.thumbnail.isNull()) {
+            item->setIcon(QPixmap::fromImage(s.thumbnail));
+        }
+        item->setData(Qt::UserRole, s.path);
+        item->setToolTip(QString("%1\nseed: %2\nversion: %3\nwildlife: %4\nraiders: %5\npacifist: %6\nsaved: %7")
+                         .arg(QDir::toNativeSeparators(s.path)).arg(d.seed).arg(d.version).arg(d.wildlifeDifficulty)
+                         .arg(d.raidersDifficulty).arg(d.pacifist)
+                         .arg(loc.toString(QDateTime::fromMSecsSinceEpoch(s.modified), QLocale::ShortFormat)));
+        if (s.path == selected) {
+            list->setCurrentItem(item);
+        }
+    }
+    if (list->currentItem() == nullptr && list->count() > 0) {
+        list->setCurrentRow(0);
+    }
+    list->setUpdatesEnabled(true);
+    ui->labelStatus->setText(QString("%1 saves").arg(list->count()));
+}
@@ -0,0 +1,42 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SAVEBROWSER_H
+#define SAVEBROWSER_H
+
+#include <QDialog>
+
+class SaveCatalog;
+
+namespace Ui {
+class SaveBrowser;
+}
+
+// Lists the saves of a SaveCatalog with their thumbnails. Shows what the catalog has at once and
+// follows it while a refresh runs.
+class SaveBrowser : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit SaveBrowser(SaveCatalog& catalog, QWidget* parent = nullptr);
+    ~SaveBrowser();
+
+    // Empty if no save is selected.
+    QString selectedPath() const;
+
+private:
+    void fill();
+
+    Ui::SaveBrowser* ui;
+    SaveCatalog& catalog_;
+};
+
+#endif // SAVEBROWSER_H
@@ -0,0 +1,246 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "SaveCatalog.h"
+#include "ByteCursor.h"
+#include "ParseData.h"
+
+namespace {
+
+constexpr char Magic[8] = { 'F', 'F', 'M', 'A', 'P', 'C', 'A', 'T' };
+// Bump whenever the file layout or SaveInfo change.
+constexpr quint32 Version = 1;
+// A save that fails to read is taken to be still being written for this long after its mtime, and
+// is read again every RetryMs meanwhile.
+constexpr qint64 WriteSettleMs = 10000;
+constexpr int RetryMs = 1000;
+
+QString catalogPath(const QString& directory)
+{
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    QByteArray key = QCryptographicHash::hash(QFileInfo(directory).absoluteFilePath().toUtf8(), QCryptographicHash::Md5).toHex();
+    return dir.filePath(QString("catalogs/%1.ffcatalog").arg(QString::fromLatin1(key)));
+}
+
+QList<SaveInfo> loadCatalog(const QString& directory)
+{
+    QFile file(catalogPath(directory));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    char magic[sizeof(Magic)];
+    quint32 version = 0;
+    quint32 count = 0;
+    if (in.readRawData(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, Magic, sizeof(Magic)) != 0) {
+        return {};
+    }
+    in >> version >> count;
+    if (version != Version) {
+        return {};
+    }
+    QList<SaveInfo> r;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        SaveInfo s;
+        in >> s.path >> s.size >> s.modified >> s.data >> s.thumbnail;
+        r.append(std::move(s));
+    }
+    if (in.status() != QDataStream::Ok) {
+        return {};
+    }
+    return r;
+}
+
+bool storeCatalog(const QString& directory, const QList<SaveInfo>& saves)
+{
+    const QFileInfo info(catalogPath(directory));
+    if (!info.dir().mkpath(".")) {
+        return false;
+    }
+    QSaveFile file(info.filePath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out.writeRawData(Magic, sizeof(Magic));
+    out << Version << quint32(saves.size());
+    for (const SaveInfo& s : saves) {
+        out << s.path << s.size << s.modified << s.data << s.thumbnail;
+    }
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+// Reports the stored catalog when starting without one, then the catalog refreshed against the
+// files in `directory`. Saves that are probably still being written are listed without data.
+void scan(QPromise<QList<SaveInfo>>& promise, const QString& directory, QList<SaveInfo> known)
+{
+    if (known.isEmpty()) {
+        known = loadCatalog(directory);
+        if (!known.isEmpty()) {
+            promise.addResult(known);
+        }
+    }
+    QHash<QString, const SaveInfo*> byPath;
+    for (const SaveInfo& s : known) {
+        byPath.insert(s.path, &s);
+    }
+
+    QList<SaveInfo> saves;
+    std::vector<qsizetype> changed;
+    QDirIterator it(directory, QStringList() << "*.sav", QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        const SaveInfo* old = byPath.value(info.filePath());
+        if (old != nullptr && old->size == info.size() && old->modified == modified) {
+            saves.append(*old);
+            continue;
+        }
+        SaveInfo s;
+        s.path = info.filePath();
+        s.size = info.size();
+        s.modified = modified;
+        changed.push_back(saves.size());
+        saves.append(std::move(s));
+    }
+    if (promise.isCanceled()) {
+        return;
+    }
+
+    SaveInfo* data = saves.data();
+    std::vector<char> ok(saves.size(), 1);
+    QtConcurrent::blockingMap(changed, [data, &ok](qsizetype i) {
+        ok[i] = SaveCatalog::readSaveInfo(data[i].path, data[i]);
+    });
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<SaveInfo> r;
+    QList<SaveInfo> unread;
+    r.reserve(saves.size());
+    for (qsizetype i = 0; i < saves.size(); ++i) {
+        if (ok[i]) {
+            r.append(std::move(saves[i]));
+        } else if (now - saves[i].modified < WriteSettleMs) {
+            SaveInfo& s = unread.emplace_back();
+            s.path = saves[i].path;
+            s.size = saves[i].size;
+            s.modified = saves[i].modified;
+        }
+    }
+    std::sort(r.begin(), r.end(), [](const SaveInfo& a, const SaveInfo& b) {
+        return a.modified > b.modified;
+    });
+    if (!changed.empty() || r.size() != known.size()) {
+        storeCatalog(directory, r);
+    }
+    promise.addResult(r + unread);
+}
+
+}
+
+SaveCatalog::SaveCatalog(QObject* parent)
+    : QObject(parent)
+{
+    connect(&scan_, &QFutureWatcher<QList<SaveInfo>>::resultReadyAt, this, [this](int index) {
+        saves_ = scan_.resultAt(index);
+        // Only a save that was read has a version; the others are left for the retry.
+        unreadSaves_ = saves_.removeIf([](const SaveInfo& s) {
+            return s.data.version.isEmpty();
+        }) > 0;
+        emit updated();
+    });
+    connect(&scan_, &QFutureWatcher<QList<SaveInfo>>::finished, this, &SaveCatalog::scanFinished);
+    retry_.setSingleShot(true);
+    retry_.setInterval(RetryMs);
+    connect(&retry_, &QTimer::timeout, this, &SaveCatalog::refresh);
+}
+
+SaveCatalog::~SaveCatalog()
+{
+    scan_.cancel();
+}
+
+void SaveCatalog::setDirectory(const QString& directory)
+{
+    if (scan_.isRunning()) {
+        scan_.cancel();
+    }
+    retry_.stop();
+    directory_ = directory;
+    saves_.clear();
+    current_ = false;
+    unreadSaves_ = false;
+    emit updated();
+    refresh();
+}
+
+void SaveCatalog::refresh()
+{
+    if (directory_.isEmpty()) {
+        return;
+    }
+    if (scan_.isRunning()) {
+        rescan_ = true;
+        return;
+    }
+    rescan_ = false;
+    scan_.setFuture(QtConcurrent::run(scan, directory_, saves_));
+}
+
+void SaveCatalog::scanFinished()
+{
+    if (!scan_.isCanceled() && !current_) {
+        current_ = true;
+        emit updated();
+    }
+    if (rescan_) {
+        refresh();
+    } else if (unreadSaves_) {
+        retry_.start();
+    }
+}
+
+bool SaveCatalog::readSaveInfo(const QString& path, SaveInfo& info)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    const uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return false;
+    }
+    // Only the pages the walked field headers are on get read from disk.
+    const QByteArrayView save(data, size);
+    bool read = false;
+    forEachSaveRecord(save, [&](const SaveRecord& r) {
+        if (parseBaseType(r.id) != BaseType::MetaData) {
+            return true;
+        }
+        ByteCursor in(save.sliced(r.fieldBegin, r.fieldSize));
+        QByteArrayView landscape;
+        info.data = parseGeneralSaveData(in, &landscape);
+        if (!in.ok() || info.data.version.isEmpty()) {
+            return false;
+        }
+        const QImage image = QImage::fromData(landscape, "PNG");
+        if (!image.isNull()) {
+            info.thumbnail = image.scaled(SaveInfo::ThumbnailSize, SaveInfo::ThumbnailSize, Qt::KeepAspectRatio,
+                                          Qt::SmoothTransformation);
+        }
+        read = true;
+        return false;
+    });
+    return read;
+}
@@ -0,0 +1,80 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SAVECATALOG_H
+#define SAVECATALOG_H
+
+#include <QFutureWatcher>
+#include <QImage>
+#include <QObject>
+#include <QTimer>
+
+#include "DataDefines.h"
+
+// A save as the catalog lists it, read from the file only up to its MetaData field.
+struct SaveInfo
+{
+    static constexpr int ThumbnailSize = 128;
+
+    QString path;
+    qint64 size = 0;
+    // Milliseconds since the epoch.
+    qint64 modified = 0;
+    GeneralSaveData data;
+    // The landscape picture of the save, at most ThumbnailSize on a side.
+    QImage thumbnail;
+};
+
+// Every save under a directory, kept up to date on the global thread pool. A refresh stats the
+// files and reads only those that are new or changed size or mtime since the last one, in
+// parallel and only as far as their MetaData field. The catalog is stored in the user's cache
+// directory, so after a restart the previous listing shows at once while the refresh runs. A save
+// that can't be read yet because the game is still writing it is read again shortly after.
+class SaveCatalog : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SaveCatalog(QObject* parent = nullptr);
+    ~SaveCatalog();
+
+    // Restores the stored catalog of `directory`, then refreshes it.
+    void setDirectory(const QString& directory);
+    void refresh();
+
+    // Newest first.
+    const QList<SaveInfo>& saves() const { return saves_; }
+    const SaveInfo* last() const { return saves_.isEmpty() ? nullptr : &saves_.front(); }
+    // A refresh has finished since setDirectory(); until then saves() may be the stored catalog.
+    bool isCurrent() const { return current_; }
+
+    // Walks the field headers of the save at `path` to its MetaData field and decodes that and the
+    // thumbnail. Returns false if the file is not a save.
+    static bool readSaveInfo(const QString& path, SaveInfo& info);
+
+signals:
+    // saves() changed or became current: the stored catalog was restored or a refresh finished.
+    void updated();
+
+private:
+    void scanFinished();
+
+    QString directory_;
+    QList<SaveInfo> saves_;
+    QFutureWatcher<QList<SaveInfo>> scan_;
+    // A refresh was asked for while one was running.
+    bool rescan_ = false;
+    bool current_ = false;
+    // Refreshes again while the last refresh found saves still being written.
+    QTimer retry_;
+    bool unreadSaves_ = false;
+};
+
+#endif // SAVECATALOG_H
@@ -7,6 +7,7 @@ SaveDialog::SaveDialog(QWidget *parent) :
 {
     ui->setupUi(this);
     ui->checkBoxPacifist->setCheckState(Qt::PartiallyChecked);
+    connect(ui->checkBoxRevealTownCenter, &QCheckBox::toggled, this, &SaveDialog::updateRevealRadius);
 }
 
 SaveDialog::~SaveDialog()
@@ -27,6 +28,35 @@ GameMapChanger::Options SaveDialog::options()
     return r;
 }
 
+bool SaveDialog::patchInPlace() const
+{
+    return ui->checkBoxPatchInPlace->isChecked();
+}
+
+bool SaveDialog::revealTownCenter() const
+{
+    return ui->checkBoxRevealTownCenter->isChecked();
+}
+
+int SaveDialog::revealRadius() const
+{
+    return ui->spinBoxRevealRadius->value();
+}
+
+void SaveDialog::setRevealPoints(int count)
+{
+    revealPoints_ = count;
+    if (count > 0) {
+        addInfo(QString("%1 marked areas will be revealed").arg(count));
+    }
+    updateRevealRadius();
+}
+
+void SaveDialog::updateRevealRadius()
+{
+    ui->spinBoxRevealRadius->setEnabled(ui->checkBoxRevealTownCenter->isChecked() || revealPoints_ > 0);
+}
+
 void SaveDialog::addInfo(const QString& text)
 {
     QString newText = ui->labelInfo->text();
@@ -34,5 +64,5 @@ void SaveDialog::addInfo(const QString& text)
         newText.append('\n');
     }
     newText.append(text);
-    ui->labelInfo->setText(text);
+    ui->labelInfo->setText(newText);
 }
@@ -17,10 +17,19 @@ public:
     ~SaveDialog();
 
     GameMapChanger::Options options();
+    bool patchInPlace() const;
+    bool revealTownCenter() const;
+    // World units to reveal around each Town Center and marked point.
+    int revealRadius() const;
+    // Enables the reveal radius for points marked on the map.
+    void setRevealPoints(int count);
     void addInfo(const QString& text);
 
 private:
+    void updateRevealRadius();
+
     Ui::SaveDialog *ui;
+    int revealPoints_ = 0;
 };
 
 #endif // SAVEDIALOG_H
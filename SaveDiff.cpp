@@ -0,0 +1,242 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "SaveDiff.h"
+#include "GameMap.h"
+#include "GameMapSnapshot.h"
+
+namespace {
+
+// Entities that don't move keep their exact coordinates from save to save.
+constexpr float SamePlace = 0.01f;
+// Join grid cell for entities that don't move.
+constexpr float StaticCell = 16;
+
+// The older list hashed by grid cell. A lookup visits the 3x3 cells around a point, so it sees
+// every entity within one cell of it.
+class JoinGrid
+{
+public:
+    template<class T>
+    JoinGrid(const std::vector<T>& items, float cell)
+        : cell_(cell)
+    {
+        cells_.reserve(qsizetype(items.size()));
+        for (uint i = 0; i < items.size(); ++i) {
+            cells_[key(cellOf(items[i].p.x), cellOf(items[i].p.z))].push_back(i);
+        }
+    }
+
+    template<class F>
+    void forNear(const Point& p, F f) const
+    {
+        const qint64 cx = cellOf(p.x);
+        const qint64 cz = cellOf(p.z);
+        for (qint64 z = cz - 1; z <= cz + 1; ++z) {
+            for (qint64 x = cx - 1; x <= cx + 1; ++x) {
+                const auto it = cells_.constFind(key(x, z));
+                if (it == cells_.cend()) {
+                    continue;
+                }
+                for (uint i : *it) {
+                    f(i);
+                }
+            }
+        }
+    }
+
+private:
+    qint64 cellOf(float v) const
+    {
+        const float c = std::floor(v / cell_);
+        return std::isfinite(c) ? qint64(qBound(-1e9f, c, 1e9f)) : 0;
+    }
+    static quint64 key(qint64 x, qint64 z) { return quint64(quint32(x)) << 32 | quint32(z); }
+
+    float cell_;
+    QHash<quint64, std::vector<uint>> cells_;
+};
+
+float distance2(const Point& a, const Point& b)
+{
+    const float dx = a.x - b.x;
+    const float dz = a.z - b.z;
+    return dx * dx + dz * dz;
+}
+
+template<class T, class Amount>
+std::vector<EntityDiff> join(EntityKind kind, const std::vector<T>& older, const std::vector<T>& newer, bool moves, Amount amount)
+{
+    const JoinGrid grid(older, moves ? MoveRadius : StaticCell);
+    std::vector<char> oldMatched(older.size());
+    std::vector<int> match(newer.size(), -1);
+    // Same place first, so an entity that stayed is never taken by a neighbour that moved.
+    for (uint n = 0; n < newer.size(); ++n) {
+        grid.forNear(newer[n].p, [&](uint o) {
+            if (match[n] < 0 && !oldMatched[o] && older[o].type == newer[n].type
+                    && distance2(older[o].p, newer[n].p) <= SamePlace * SamePlace) {
+                match[n] = int(o);
+                oldMatched[o] = 1;
+            }
+        });
+    }
+    if (moves) {
+        for (uint n = 0; n < newer.size(); ++n) {
+            if (match[n] >= 0) {
+                continue;
+            }
+            int best = -1;
+            float bestDistance = MoveRadius * MoveRadius;
+            grid.forNear(newer[n].p, [&](uint o) {
+                const float d = distance2(older[o].p, newer[n].p);
+                if (!oldMatched[o] && older[o].type == newer[n].type && d <= bestDistance) {
+                    best = int(o);
+                    bestDistance = d;
+                }
+            });
+            if (best >= 0) {
+                match[n] = best;
+                oldMatched[best] = 1;
+            }
+        }
+    }
+
+    std::vector<EntityDiff> r;
+    for (uint n = 0; n < newer.size(); ++n) {
+        EntityDiff d;
+        d.kind = kind;
+        d.newIndex = int(n);
+        d.to = newer[n].p;
+        d.newAmount = amount(newer[n]);
+        if (match[n] < 0) {
+            d.change = EntityDiff::Added;
+            d.from = d.to;
+            r.push_back(d);
+            continue;
+        }
+        const T& o = older[match[n]];
+        d.oldIndex = match[n];
+        d.from = o.p;
+        d.oldAmount = amount(o);
+        if (distance2(o.p, newer[n].p) > SamePlace * SamePlace) {
+            d.change = EntityDiff::Moved;
+            r.push_back(d);
+        } else if (d.oldAmount != d.newAmount) {
+            d.change = EntityDiff::AmountChanged;
+            r.push_back(d);
+        }
+    }
+    for (uint o = 0; o < older.size(); ++o) {
+        if (oldMatched[o]) {
+            continue;
+        }
+        EntityDiff d;
+        d.kind = kind;
+        d.change = EntityDiff::Removed;
+        d.oldIndex = int(o);
+        d.from = d.to = older[o].p;
+        d.oldAmount = amount(older[o]);
+        r.push_back(d);
+    }
+    return r;
+}
+
+// Decodes the entity lists of `kinds` only; everything else stays empty.
+GameMapSnapshot readKinds(GameMap& map, SpatialIndex::KindMask kinds)
+{
+    GameMapSnapshot r;
+    QList<QFuture<void>> jobs;
+    auto read = [&](EntityKind kind, auto member, auto reader) {
+        if (kinds & SpatialIndex::kindMask(kind)) {
+            jobs << QtConcurrent::run([&map, &r, member, reader]() {
+                r.*member = (map.reader().*reader)();
+            });
+        }
+    };
+    read(EntityKind::Mineral, &GameMapSnapshot::minerals, &GameMap::SaveReader::minerals);
+    read(EntityKind::Forageable, &GameMapSnapshot::forageables, &GameMap::SaveReader::forageables);
+    read(EntityKind::Animal, &GameMapSnapshot::animals, &GameMap::SaveReader::animals);
+    read(EntityKind::Raider, &GameMapSnapshot::raiders, &GameMap::SaveReader::raiders);
+    read(EntityKind::House, &GameMapSnapshot::houses, &GameMap::SaveReader::houses);
+    for (auto& job : jobs) {
+        job.waitForFinished();
+    }
+    return r;
+}
+
+}
+
+uint SaveDiff::count(EntityKind kind, EntityDiff::Change change) const
+{
+    return uint(std::count_if(entries.begin(), entries.end(), [&](const EntityDiff& d) {
+        return d.kind == kind && d.change == change;
+    }));
+}
+
+SaveDiff diffSnapshots(const GameMapSnapshot& older, const GameMapSnapshot& newer, SpatialIndex::KindMask kinds)
+{
+    std::vector<EntityDiff> parts[uint(EntityKind::Count)];
+    auto amount = [](const auto& d) { return uint(d.amount); };
+    auto noAmount = [](const auto&) { return 0u; };
+    QList<QFuture<void>> jobs;
+    auto diff = [&](EntityKind kind, const auto& oldList, const auto& newList, bool moves, auto amountOf) {
+        if ((kinds & SpatialIndex::kindMask(kind)) == 0) {
+            return;
+        }
+        std::vector<EntityDiff>* out = &parts[uint(kind)];
+        jobs << QtConcurrent::run([kind, &oldList, &newList, moves, amountOf, out]() {
+            *out = join(kind, oldList, newList, moves, amountOf);
+        });
+    };
+    diff(EntityKind::Mineral, older.minerals, newer.minerals, false, amount);
+    diff(EntityKind::Forageable, older.forageables, newer.forageables, false, amount);
+    diff(EntityKind::Animal, older.animals, newer.animals, true, noAmount);
+    diff(EntityKind::Raider, older.raiders, newer.raiders, true, noAmount);
+    diff(EntityKind::House, older.houses, newer.houses, false, noAmount);
+    for (auto& job : jobs) {
+        job.waitForFinished();
+    }
+
+    SaveDiff r;
+    r.skipped = SpatialIndex::AllKinds & ~kinds;
+    for (const std::vector<EntityDiff>& part : parts) {
+        r.entries.insert(r.entries.end(), part.begin(), part.end());
+    }
+    return r;
+}
+
+SaveDiff diffSaves(GameMap& older, GameMap& newer)
+{
+    const std::pair<EntityKind, GameMapSnapshot::Part> sources[] = {
+        { EntityKind::Mineral, GameMapSnapshot::Minerals },
+        { EntityKind::Forageable, GameMapSnapshot::Forageables },
+        { EntityKind::Animal, GameMapSnapshot::Animals },
+        { EntityKind::Raider, GameMapSnapshot::Raiders },
+        { EntityKind::House, GameMapSnapshot::Houses },
+    };
+    const QHash<BaseType, quint64>& oldHashes = older.fieldHashes();
+    const QHash<BaseType, quint64>& newHashes = newer.fieldHashes();
+    SpatialIndex::KindMask kinds = 0;
+    for (const auto& [kind, part] : sources) {
+        for (BaseType type : GameMapSnapshot::sourceFields(part)) {
+            if (oldHashes.value(type) != newHashes.value(type)) {
+                kinds |= SpatialIndex::kindMask(kind);
+                break;
+            }
+        }
+    }
+    if (kinds == 0) {
+        SaveDiff r;
+        r.skipped = SpatialIndex::AllKinds;
+        return r;
+    }
+    return diffSnapshots(readKinds(older, kinds), *newer.snapshot(), kinds);
+}
@@ -0,0 +1,70 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SAVEDIFF_H
+#define SAVEDIFF_H
+
+#include "DataDefines.h"
+#include "SpatialIndex.h"
+
+#include <vector>
+
+class GameMap;
+struct GameMapSnapshot;
+
+// One entity that differs between an older and a newer save of a game.
+struct EntityDiff
+{
+    enum Change
+    {
+        // Only in the newer save.
+        Added,
+        // Only in the older save: mined out, eaten, killed or gone.
+        Removed,
+        // An animal or raider that is within MoveRadius of where it was.
+        Moved,
+        // A mineral or forageable in the same place with a different amount.
+        AmountChanged
+    };
+
+    EntityKind kind;
+    Change change;
+    // Index in the lists of the older and the newer snapshot; -1 where the entity is missing.
+    int oldIndex = -1;
+    int newIndex = -1;
+    Point from = {};
+    Point to = {};
+    uint oldAmount = 0;
+    uint newAmount = 0;
+};
+
+struct SaveDiff
+{
+    std::vector<EntityDiff> entries;
+    // Kinds whose save fields were byte-identical, so their entities were not compared.
+    SpatialIndex::KindMask skipped = 0;
+
+    // How many entries of `kind` have `change`.
+    uint count(EntityKind kind, EntityDiff::Change change) const;
+};
+
+// Farthest an animal or raider is matched to its earlier position, in world units.
+constexpr float MoveRadius = 64;
+
+// Matches the entities of `kinds` in the two snapshots by a spatial hash join: entities of the
+// same type at the same position first, then, for animals and raiders, the nearest unmatched one
+// within MoveRadius. Unchanged entities are left out.
+SaveDiff diffSnapshots(const GameMapSnapshot& older, const GameMapSnapshot& newer, SpatialIndex::KindMask kinds);
+// Diffs two saves of a game, skipping every kind whose save fields hash the same in both. Only
+// the changed kinds of `older` are decoded, so it can be opened with GameMap::openSave(); `newer`
+// is compared through its snapshot.
+SaveDiff diffSaves(GameMap& older, GameMap& newer);
+
+#endif // SAVEDIFF_H
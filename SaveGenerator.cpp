@@ -0,0 +1,370 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "SaveGenerator.h"
+#include "ParseData.h"
+
+namespace {
+
+constexpr uint CellSize = 5;
+constexpr uint SpawnAreaSize = 64;
+
+const char* const ForageableItems[] = { "ItemGreens", "ItemHerbs", "ItemRoots", "ItemWillow", "ItemBerries" };
+
+const char* const RaiderUUIDs[] = {
+    "7b8e2ab8-2511-4b09-b2a3-7d020d200654",
+    "f7eb7176-4b2d-450b-b991-aa4854de3b70",
+    "d46bd838-4635-4248-917b-a8bb8df8bbc2",
+    "1c6eff9d-3d70-4758-8688-b0184883c41a",
+    "93fc8b22-7dcf-4103-a5b8-7fe0d86fd46b"
+};
+
+const char* const SpawnUUIDs[] = {
+    "ac4a8fd7-b9cb-44e4-be78-105e11c07bd1",
+    "9347bbe9-23eb-4f2a-90ab-f9620a2d8665",
+    "1b89ffdd-78ca-4dc0-bbd4-cd81cda57fe1",
+    "43c882e6-a835-4a85-a028-186c8a53e855"
+};
+
+QDataStream& fieldStream(QDataStream& out)
+{
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    return out;
+}
+
+void writeArray(QDataStream& out, const QByteArray& v)
+{
+    out << quint8(v.size());
+    out.writeRawData(v.constData(), v.size());
+}
+
+void writeZeros(QDataStream& out, int count)
+{
+    const QByteArray zeros(count, '\0');
+    out.writeRawData(zeros.constData(), zeros.size());
+}
+
+}
+
+SaveGenerator::Params SaveGenerator::scaled(uint worldSize, double density, quint32 seed)
+{
+    Params r;
+    const double k = double(worldSize) * worldSize / (double(r.worldSize) * r.worldSize) * density;
+    auto scale = [k](uint v) {
+        return uint(std::max(1.0, v * k));
+    };
+    r.seed = seed;
+    r.worldSize = worldSize;
+    r.minerals = scale(r.minerals);
+    r.deepMinerals = scale(r.deepMinerals);
+    r.forageables = scale(r.forageables);
+    r.raiders = scale(r.raiders);
+    r.batteringRams = scale(r.batteringRams);
+    r.animals = scale(r.animals);
+    r.wolfDens = scale(r.wolfDens);
+    r.shelters = scale(r.shelters);
+    r.herds = scale(r.herds);
+    r.spawnAreas = std::min(scale(r.spawnAreas), (worldSize / SpawnAreaSize) * (worldSize / SpawnAreaSize));
+    r.buildingSites = scale(r.buildingSites);
+    return r;
+}
+
+SaveGenerator::SaveGenerator(const Params& params)
+    : params_(params)
+    , rng_(params.seed)
+{
+}
+
+QByteArray SaveGenerator::generate()
+{
+    rng_.seed(params_.seed);
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+
+    writeRecord(out, BaseType::MetaData, metaData());
+    writeRecord(out, BaseType::CameraManager, camera());
+    writeRecord(out, BaseType::TerrainManager, terrain());
+    writeRecord(out, BaseType::AgricultureManager, agriculture());
+    writeRecord(out, BaseType::FoWSystem, fow());
+    writeRecord(out, BaseType::MineralManager, minerals());
+    writeRecord(out, BaseType::AnimalManager, animalManager());
+    for (uint i = 0; i < params_.forageables; ++i) {
+        writeRecord(out, BaseType::ForageableResource, forageable());
+    }
+    for (uint i = 0; i < params_.raiders; ++i) {
+        writeRecord(out, BaseType::Raider, raider(false));
+    }
+    for (uint i = 0; i < params_.batteringRams; ++i) {
+        writeRecord(out, BaseType::BatteringRam, raider(true));
+    }
+    for (BaseType type : { BaseType::Deer, BaseType::Bear, BaseType::Boar, BaseType::Wolf }) {
+        for (uint i = 0; i < params_.animals; ++i) {
+            writeRecord(out, type, animal());
+        }
+    }
+    for (uint i = 0; i < params_.wolfDens; ++i) {
+        writeRecord(out, BaseType::WolfDen, animal());
+    }
+    writeRecord(out, BaseType::TownCenter, house());
+    for (uint i = 0; i < params_.shelters; ++i) {
+        writeRecord(out, BaseType::Shelter, house());
+    }
+    for (uint i = 0; i < params_.buildingSites; ++i) {
+        writeRecord(out, BaseType::BuildingBuildSite, buildingSite());
+    }
+    return r;
+}
+
+bool SaveGenerator::write(const QString& path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    const QByteArray data = generate();
+    if (file.write(data) != data.size()) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+uint SaveGenerator::below(uint n)
+{
+    return n ? rng_() % n : 0;
+}
+
+float SaveGenerator::uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * float(rng_() / 4294967296.0);
+}
+
+Point SaveGenerator::point()
+{
+    return { uniform(0, params_.worldSize), uniform(0, 50), uniform(0, params_.worldSize) };
+}
+
+void SaveGenerator::writeRecord(QDataStream& out, BaseType type, const QByteArray& field)
+{
+    // componentType, name (quint8 length + bytes), fieldSize, id
+    out << quint8(0);
+    writeArray(out, QByteArray("Component"));
+    out << quint32(field.size() + 4);
+    out << quint32(baseTypeId(type));
+    out.writeRawData(field.constData(), field.size());
+}
+
+QByteArray SaveGenerator::metaData()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 5);
+    writeArray(out, "v0.9.1");
+    writeArray(out, QByteArray::number(params_.seed));
+    out << quint8(1) << quint8(1) << quint8(2) << quint8(2) << quint8(0);
+    writeArray(out, "Synthetic");
+    out << quint32(100) << quint32(10) << quint32(0) << quint32(0) << quint32(0) << quint32(5) << quint32(30);
+    out << quint32(0); // png
+    return r;
+}
+
+QByteArray SaveGenerator::camera()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 1);
+    out << point();
+    return r;
+}
+
+QByteArray SaveGenerator::minerals()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 1);
+    // Clay, sand and deep stone, then the ore list with ids.
+    const uint listed[3] = { params_.minerals / 4, params_.minerals / 4, params_.deepMinerals };
+    for (uint list = 0; list < 3; ++list) {
+        out << quint32(listed[list]);
+        for (uint i = 0; i < listed[list]; ++i) {
+            out << point() << uniform(10, 40) << quint32(100 + below(900)) << quint8(list == 2 ? 1 : 0);
+        }
+    }
+    const uint ores = params_.minerals - 2 * (params_.minerals / 4);
+    out << quint32(ores);
+    for (uint i = 0; i < ores; ++i) {
+        out << quint32(i + 1) << quint32(below(3)) << point() << uniform(10, 40) << quint32(100 + below(900)) << quint8(below(10) == 0);
+    }
+    // Deposits and ore positions, which only GameMapChanger walks.
+    out << quint32(0);
+    writeZeros(out, 1);
+    out << quint32(ores);
+    writeZeros(out, ores * 20);
+    writeZeros(out, 1);
+    return r;
+}
+
+QByteArray SaveGenerator::forageable()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 5);
+    out << quint8(1);
+    writeZeros(out, 1 + 4);
+    out << point();
+    writeZeros(out, 28);
+    writeArray(out, "ForagingResource");
+    writeZeros(out, 1);
+    out << quint32(0); // available items
+    writeZeros(out, 33);
+    out << quint32(1);
+    writeArray(out, ForageableItems[below(std::size(ForageableItems))]);
+    out << quint32(5 + below(20));
+    return r;
+}
+
+QByteArray SaveGenerator::raider(bool batteringRam)
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 6);
+    out << point();
+    writeZeros(out, 28);
+    writeArray(out, batteringRam ? "BatteringRam" : "Raider");
+    out << uniform(50, 200);
+    writeZeros(out, 1);
+    out << point();
+    writeZeros(out, 1);
+    if (batteringRam) {
+        return r;
+    }
+    out << quint32(0); // looted items
+    out << 250.0f;
+    writeZeros(out, 2);
+    out << quint32(0); // own items
+    writeZeros(out, 5);
+    out << 250.0f;
+    writeArray(out, RaiderUUIDs[below(std::size(RaiderUUIDs))]);
+    return r;
+}
+
+QByteArray SaveGenerator::animal()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 6);
+    out << point();
+    writeZeros(out, 64);
+    return r;
+}
+
+QByteArray SaveGenerator::house()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 7);
+    out << point();
+    writeZeros(out, 64);
+    return r;
+}
+
+QByteArray SaveGenerator::animalManager()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 2);
+    out << quint32(params_.herds);
+    for (uint i = 0; i < params_.herds; ++i) {
+        writeZeros(out, 1);
+        const uint workers = below(5);
+        out << quint32(workers);
+        writeZeros(out, workers * 4);
+        writeArray(out, "Herd");
+        writeZeros(out, 15);
+        out << quint8(0);
+        writeZeros(out, 45);
+    }
+    const uint areas = (params_.worldSize / SpawnAreaSize) * (params_.worldSize / SpawnAreaSize);
+    out << quint32(params_.spawnAreas);
+    for (uint i = 0; i < params_.spawnAreas; ++i) {
+        out << quint32(below(areas));
+        writeArray(out, SpawnUUIDs[below(std::size(SpawnUUIDs))]);
+    }
+    return r;
+}
+
+QByteArray SaveGenerator::agriculture()
+{
+    const uint cells = params_.worldSize / CellSize;
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 6);
+    out << float(params_.worldSize) << float(params_.worldSize) << quint32(cells) << quint32(cells);
+    // Smooth fields so the thresholded overlays form regions rather than noise.
+    const float fx = uniform(2, 6) / cells;
+    const float fy = uniform(2, 6) / cells;
+    for (uint x = 0; x < cells; ++x) {
+        for (uint y = 0; y < cells; ++y) {
+            for (uint t = 0; t < AgricultureInfo::Max; ++t) {
+                const float v = 0.5f + 0.25f * (std::sin((x + 7 * t) * fx * 6.2832f) + std::cos((y + 3 * t) * fy * 6.2832f));
+                out << v;
+            }
+        }
+    }
+    return r;
+}
+
+QByteArray SaveGenerator::terrain()
+{
+    const uint size = params_.worldSize / CellSize + 1;
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 1);
+    out << quint32(0) << quint32(0) << quint32(0) << quint32(0); // trees and objects
+    out << quint32(0);
+    out << quint32(size) << quint32(size * size);
+    for (uint z = 0; z < size; ++z) {
+        for (uint x = 0; x < size; ++x) {
+            out << 20.0f + 10.0f * std::sin(x * 0.05f) * std::cos(z * 0.03f);
+        }
+    }
+    return r;
+}
+
+QByteArray SaveGenerator::fow()
+{
+    const uint size = params_.worldSize / CellSize;
+    QByteArray r(4 + size_t(size) * size * 4, '\0');
+    return r;
+}
+
+QByteArray SaveGenerator::buildingSite()
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    fieldStream(out);
+    writeZeros(out, 6);
+    out << point();
+    writeZeros(out, 48);
+    return r;
+}
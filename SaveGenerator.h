@@ -0,0 +1,73 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SAVEGENERATOR_H
+#define SAVEGENERATOR_H
+
+#include <random>
+
+#include "DataDefines.h"
+
+// Builds synthetic saves in the record layout GameMap parses, with every BaseType it understands.
+// The output depends only on the parameters, so runs are comparable between machines and builds.
+class SaveGenerator
+{
+public:
+    struct Params
+    {
+        quint32 seed = 1;
+        // World size in game units. The agriculture, terrain and FoW grids use 5 units per cell.
+        uint worldSize = 2560;
+        uint minerals = 300;
+        uint deepMinerals = 30;
+        uint forageables = 1500;
+        uint raiders = 40;
+        uint batteringRams = 4;
+        // Per animal type: Deer, Bear, Boar and Wolf.
+        uint animals = 200;
+        uint wolfDens = 8;
+        uint shelters = 20;
+        uint herds = 8;
+        uint spawnAreas = 150;
+        uint buildingSites = 40;
+    };
+
+    // Entity counts grow with the map area, times `density`.
+    static Params scaled(uint worldSize, double density = 1, quint32 seed = 1);
+
+    explicit SaveGenerator(const Params& params);
+
+    QByteArray generate();
+    bool write(const QString& path);
+
+private:
+    Params params_;
+    std::mt19937 rng_;
+
+    uint below(uint n);
+    float uniform(float lo, float hi);
+    Point point();
+
+    void writeRecord(QDataStream& out, BaseType type, const QByteArray& field);
+    QByteArray metaData();
+    QByteArray camera();
+    QByteArray minerals();
+    QByteArray forageable();
+    QByteArray raider(bool batteringRam);
+    QByteArray animal();
+    QByteArray house();
+    QByteArray animalManager();
+    QByteArray agriculture();
+    QByteArray terrain();
+    QByteArray fow();
+    QByteArray buildingSite();
+};
+
+#endif // SAVEGENERATOR_H
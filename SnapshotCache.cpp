@@ -0,0 +1,422 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "SnapshotCache.h"
+#include "GameMapSnapshot.h"
+#include "ParseData.h"
+
+namespace {
+
+constexpr char Magic[8] = { 'F', 'F', 'M', 'A', 'P', 'S', 'N', 'P' };
+// Bump whenever the file layout or any of the cached structs change.
+constexpr quint32 Version = 3;
+constexpr qint64 HashBlockSize = 64 * 1024;
+constexpr qint64 HashBlocks = 16;
+// Caches beyond either limit are removed, least recently used (by mtime) first.
+constexpr int MaxCaches = 32;
+constexpr qint64 MaxCacheBytes = 512LL * 1024 * 1024;
+
+enum class Section : quint32
+{
+    Fields,
+    GeneralSaveData,
+    Camera,
+    Minerals,
+    Forageables,
+    Raiders,
+    Animals,
+    Houses,
+    AnimalsSpawns,
+    Agriculture,
+    HeightMap,
+    FieldHashes,
+    Max
+};
+
+struct Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 sectionCount;
+    qint64 saveSize;
+    qint64 saveModified;
+    char contentHash[16];
+};
+
+struct SectionEntry
+{
+    quint64 offset;
+    quint64 size;
+};
+
+struct FieldEntry
+{
+    quint32 type;
+    quint32 reserved;
+    quint64 offset;
+    quint64 size;
+};
+
+struct FieldHashEntry
+{
+    quint32 type;
+    quint32 reserved;
+    quint64 hash;
+};
+
+struct GridHeader
+{
+    float worldWidth;
+    float worldHeight;
+    quint32 width;
+    quint32 height;
+};
+
+constexpr qint64 SectionTableSize = sizeof(SectionEntry) * qint64(Section::Max);
+constexpr qint64 DataOffset = sizeof(Header) + SectionTableSize;
+
+// Sections are 8-byte aligned, so every array in the file can be read in place.
+class CacheWriter
+{
+public:
+    CacheWriter()
+        : data_(DataOffset, '\0')
+    {
+    }
+
+    void begin(Section type)
+    {
+        data_.append((8 - data_.size() % 8) % 8, '\0');
+        current_ = type;
+        sections_[uint(type)].offset = data_.size();
+    }
+    void append(const void* data, qint64 size)
+    {
+        data_.append(static_cast<const char*>(data), size);
+    }
+    template<class T>
+    void append(const std::vector<T>& v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        append(v.data(), v.size() * sizeof(T));
+    }
+    void end()
+    {
+        SectionEntry& e = sections_[uint(current_)];
+        e.size = data_.size() - e.offset;
+    }
+    QByteArray finish(const Header& header)
+    {
+        memcpy(data_.data(), &header, sizeof(Header));
+        memcpy(data_.data() + sizeof(Header), sections_, SectionTableSize);
+        return data_;
+    }
+
+private:
+    QByteArray data_;
+    Section current_ = Section::Max;
+    SectionEntry sections_[uint(Section::Max)] = {};
+};
+
+class CacheReader
+{
+public:
+    explicit CacheReader(QByteArrayView data)
+        : data_(data)
+    {
+        if (data_.size() >= DataOffset) {
+            memcpy(&header_, data_.data(), sizeof(Header));
+            memcpy(sections_, data_.data() + sizeof(Header), SectionTableSize);
+        }
+    }
+
+    const Header& header() const { return header_; }
+    bool isValid() const
+    {
+        return data_.size() >= DataOffset && memcmp(header_.magic, Magic, sizeof(Magic)) == 0
+            && header_.version == Version && header_.sectionCount == quint32(Section::Max);
+    }
+    QByteArrayView section(Section type) const
+    {
+        const SectionEntry& e = sections_[uint(type)];
+        if (e.offset > quint64(data_.size()) || e.size > quint64(data_.size()) - e.offset) {
+            return QByteArrayView();
+        }
+        return data_.sliced(e.offset, e.size);
+    }
+    template<class T>
+    bool read(Section type, std::vector<T>& v) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        QByteArrayView s = section(type);
+        if (s.size() % sizeof(T) != 0) {
+            return false;
+        }
+        v.resize(s.size() / sizeof(T));
+        memcpy(v.data(), s.data(), s.size());
+        return true;
+    }
+
+private:
+    QByteArrayView data_;
+    Header header_ = {};
+    SectionEntry sections_[uint(Section::Max)] = {};
+};
+
+QByteArray serialize(const GeneralSaveData& d)
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    out << d;
+    return r;
+}
+
+bool deserialize(QByteArrayView data, GeneralSaveData& d)
+{
+    QDataStream in(QByteArray::fromRawData(data.data(), data.size()));
+    in >> d;
+    return in.status() == QDataStream::Ok;
+}
+
+void prune(const QDir& dir)
+{
+    const QFileInfoList caches = dir.entryInfoList(QStringList() << "*.ffcache", QDir::Files, QDir::Time);
+    qint64 bytes = 0;
+    for (qsizetype i = 0; i < caches.size(); ++i) {
+        bytes += caches[i].size();
+        if (i >= MaxCaches || bytes > MaxCacheBytes) {
+            QFile::remove(caches[i].filePath());
+        }
+    }
+}
+
+}
+
+SnapshotCache::SnapshotCache(const QString& savePath)
+{
+    QFileInfo info(savePath);
+    saveModified_ = info.lastModified().toMSecsSinceEpoch();
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    QByteArray key = QCryptographicHash::hash(info.absoluteFilePath().toUtf8(), QCryptographicHash::Md5).toHex();
+    cachePath_ = dir.filePath(QString("snapshots/%1.ffcache").arg(QString::fromLatin1(key)));
+}
+
+QByteArray SnapshotCache::contentHash(QByteArrayView save) const
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    const qint64 size = save.size();
+    if (size <= HashBlocks * HashBlockSize) {
+        hash.addData(save);
+    } else {
+        // Sampling keeps the check cheap on large saves; size and mtime catch the rest.
+        const qint64 step = (size - HashBlockSize) / (HashBlocks - 1);
+        for (qint64 i = 0; i < HashBlocks; ++i) {
+            hash.addData(save.sliced(i * step, HashBlockSize));
+        }
+    }
+    return hash.result();
+}
+
+bool SnapshotCache::load(QByteArrayView save, FieldTable& table, FieldHashes& hashes, QSharedPointer<const GameMapSnapshot>& snapshot,
+                         QSharedPointer<const HeightMap>& heightMap) const
+{
+    QFile file(cachePath_);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    const uchar* data = size >= DataOffset ? file.map(0, size) : nullptr;
+    if (data == nullptr) {
+        return false;
+    }
+    CacheReader cache(QByteArrayView(data, size));
+    const Header& header = cache.header();
+    if (!cache.isValid() || header.saveSize != save.size() || header.saveModified != saveModified_
+        || contentHash(save) != QByteArray(header.contentHash, sizeof(header.contentHash))) {
+        return false;
+    }
+
+    std::vector<FieldEntry> fields;
+    if (!cache.read(Section::Fields, fields)) {
+        return false;
+    }
+    FieldTable fieldTable;
+    for (const FieldEntry& f : fields) {
+        if (f.type > uint(BaseType::Unknown) || f.offset > quint64(save.size()) || f.size > quint64(save.size()) - f.offset) {
+            return false;
+        }
+        fieldTable[static_cast<BaseType>(f.type)].push_back(save.sliced(f.offset, f.size));
+    }
+    std::vector<FieldHashEntry> fieldHashes;
+    if (!cache.read(Section::FieldHashes, fieldHashes)) {
+        return false;
+    }
+    FieldHashes hashTable;
+    for (const FieldHashEntry& f : fieldHashes) {
+        if (f.type > uint(BaseType::Unknown)) {
+            return false;
+        }
+        hashTable.insert(static_cast<BaseType>(f.type), f.hash);
+    }
+
+    auto s = QSharedPointer<GameMapSnapshot>::create();
+    QByteArrayView camera = cache.section(Section::Camera);
+    if (!deserialize(cache.section(Section::GeneralSaveData), s->generalSaveData) || camera.size() != sizeof(Point)
+        || !cache.read(Section::Minerals, s->minerals) || !cache.read(Section::Forageables, s->forageables)
+        || !cache.read(Section::Raiders, s->raiders) || !cache.read(Section::Animals, s->animals)
+        || !cache.read(Section::Houses, s->houses) || !cache.read(Section::AnimalsSpawns, s->animalsSpawns)) {
+        return false;
+    }
+    memcpy(&s->camera, camera.data(), sizeof(Point));
+
+    QByteArrayView agriculture = cache.section(Section::Agriculture);
+    GridHeader grid;
+    if (agriculture.size() < qint64(sizeof(GridHeader))) {
+        return false;
+    }
+    memcpy(&grid, agriculture.data(), sizeof(GridHeader));
+    const qint64 planeSize = qint64(grid.width) * grid.height * sizeof(float);
+    if (agriculture.size() != qint64(sizeof(GridHeader)) + planeSize * AgricultureInfo::Max) {
+        return false;
+    }
+    s->agricultureData.worldWidth = grid.worldWidth;
+    s->agricultureData.worldHeight = grid.worldHeight;
+    s->agricultureData.resize(grid.width, grid.height);
+    if (planeSize > 0) {
+        for (uint t = 0; t < AgricultureInfo::Max; ++t) {
+            memcpy(s->agricultureData.plane(static_cast<AgricultureInfo::DataType>(t)),
+                   agriculture.data() + sizeof(GridHeader) + t * planeSize, planeSize);
+        }
+    }
+
+    QByteArrayView heights = cache.section(Section::HeightMap);
+    QSharedPointer<HeightMap> h;
+    if (!heights.isEmpty()) {
+        h = QSharedPointer<HeightMap>::create();
+        if (heights.size() < qint64(sizeof(quint32))) {
+            return false;
+        }
+        memcpy(&h->size, heights.data(), sizeof(quint32));
+        if (heights.size() != qint64(sizeof(quint32)) + qint64(h->size) * h->size * qint64(sizeof(float))) {
+            return false;
+        }
+        h->heights.resize(size_t(h->size) * h->size);
+        memcpy(h->heights.data(), heights.data() + sizeof(quint32), h->heights.size() * sizeof(float));
+    }
+
+    // Cheaper to rebuild than to store.
+    s->index.build(*s);
+
+    table.swap(fieldTable);
+    hashes.swap(hashTable);
+    snapshot = s;
+    heightMap = h;
+    // Marks the cache as recently used for prune(); the header keeps the save's own mtime.
+    file.close();
+    if (file.open(QIODevice::ReadWrite)) {
+        file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+bool SnapshotCache::store(QByteArrayView save, const FieldTable& table, const FieldHashes& hashes, const GameMapSnapshot& snapshot,
+                          const HeightMap* heightMap) const
+{
+    CacheWriter cache;
+
+    std::vector<FieldEntry> fields;
+    for (auto i = table.begin(); i != table.end(); ++i) {
+        for (const QByteArrayView& f : i.value()) {
+            fields.push_back({ quint32(i.key()), 0, quint64(f.data() - save.data()), quint64(f.size()) });
+        }
+    }
+    cache.begin(Section::Fields);
+    cache.append(fields);
+    cache.end();
+
+    std::vector<FieldHashEntry> fieldHashes;
+    for (auto i = hashes.begin(); i != hashes.end(); ++i) {
+        fieldHashes.push_back({ quint32(i.key()), 0, i.value() });
+    }
+    cache.begin(Section::FieldHashes);
+    cache.append(fieldHashes);
+    cache.end();
+
+    const QByteArray general = serialize(snapshot.generalSaveData);
+    cache.begin(Section::GeneralSaveData);
+    cache.append(general.constData(), general.size());
+    cache.end();
+    cache.begin(Section::Camera);
+    cache.append(&snapshot.camera, sizeof(Point));
+    cache.end();
+    cache.begin(Section::Minerals);
+    cache.append(snapshot.minerals);
+    cache.end();
+    cache.begin(Section::Forageables);
+    cache.append(snapshot.forageables);
+    cache.end();
+    cache.begin(Section::Raiders);
+    cache.append(snapshot.raiders);
+    cache.end();
+    cache.begin(Section::Animals);
+    cache.append(snapshot.animals);
+    cache.end();
+    cache.begin(Section::Houses);
+    cache.append(snapshot.houses);
+    cache.end();
+    cache.begin(Section::AnimalsSpawns);
+    cache.append(snapshot.animalsSpawns);
+    cache.end();
+
+    const AgricultureInfo::Data& agriculture = snapshot.agricultureData;
+    const GridHeader grid = { agriculture.worldWidth, agriculture.worldHeight, agriculture.width(), agriculture.height() };
+    cache.begin(Section::Agriculture);
+    cache.append(&grid, sizeof(GridHeader));
+    if (!agriculture.isEmpty()) {
+        for (uint t = 0; t < AgricultureInfo::Max; ++t) {
+            cache.append(agriculture.plane(static_cast<AgricultureInfo::DataType>(t)),
+                         qint64(agriculture.width()) * agriculture.height() * sizeof(float));
+        }
+    }
+    cache.end();
+
+    cache.begin(Section::HeightMap);
+    if (heightMap != nullptr) {
+        const quint32 heightMapSize = heightMap->size;
+        cache.append(&heightMapSize, sizeof(quint32));
+        cache.append(heightMap->heights);
+    }
+    cache.end();
+
+    Header header = {};
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.sectionCount = quint32(Section::Max);
+    header.saveSize = save.size();
+    header.saveModified = saveModified_;
+    const QByteArray hash = contentHash(save);
+    memcpy(header.contentHash, hash.constData(), sizeof(header.contentHash));
+
+    QFileInfo info(cachePath_);
+    if (!info.dir().mkpath(".")) {
+        return false;
+    }
+    QSaveFile file(cachePath_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(cache.finish(header));
+    if (!file.commit()) {
+        return false;
+    }
+    prune(info.dir());
+    return true;
+}
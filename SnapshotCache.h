@@ -0,0 +1,45 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SNAPSHOTCACHE_H
+#define SNAPSHOTCACHE_H
+
+#include "DataDefines.h"
+
+struct GameMapSnapshot;
+
+// On-disk copy of everything GameMap decodes from a save: the field table, the snapshot and the
+// height grid. The cache lives in the user's cache directory under a name derived from the save
+// path, and is only used while the save size, modification time and sampled content hash match.
+// The directory is kept to a few saves' worth, dropping the least recently used caches first.
+class SnapshotCache
+{
+public:
+    using FieldTable = QHash<BaseType, QVector<QByteArrayView>>;
+    using FieldHashes = QHash<BaseType, quint64>;
+
+    explicit SnapshotCache(const QString& savePath);
+
+    // Fills the table with views into `save` and restores the decoded data. Returns false on a
+    // missing, stale or damaged cache. `heightMap` is left null if it was stored without one.
+    bool load(QByteArrayView save, FieldTable& table, FieldHashes& hashes, QSharedPointer<const GameMapSnapshot>& snapshot,
+              QSharedPointer<const HeightMap>& heightMap) const;
+    // `heightMap` may be null when the heights haven't been decoded yet.
+    bool store(QByteArrayView save, const FieldTable& table, const FieldHashes& hashes, const GameMapSnapshot& snapshot,
+               const HeightMap* heightMap) const;
+
+private:
+    QByteArray contentHash(QByteArrayView save) const;
+
+    QString cachePath_;
+    qint64 saveModified_ = 0;
+};
+
+#endif // SNAPSHOTCACHE_H
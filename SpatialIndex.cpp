@@ -0,0 +1,143 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stdafx.h"
+#include "SpatialIndex.h"
+#include "GameMapSnapshot.h"
+
+namespace {
+
+// Entities per cell the grid is sized for.
+constexpr double CellLoad = 4;
+// Cells per entity the grid may have at most, however far apart the entities are.
+constexpr double MaxCellLoad = 4;
+
+}
+
+void SpatialIndex::build(const GameMapSnapshot& snapshot)
+{
+    struct Entry
+    {
+        Item item;
+        EntityKind kind;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(snapshot.minerals.size() + snapshot.forageables.size() + snapshot.animals.size()
+                    + snapshot.raiders.size() + snapshot.houses.size());
+    auto add = [&entries](EntityKind kind, const auto& list) {
+        for (size_t i = 0; i < list.size(); ++i) {
+            const Point& p = list[i].p;
+            if (std::isfinite(p.x) && std::isfinite(p.z)) {
+                entries.push_back({ { p.x, p.z, uint(i) }, kind });
+            }
+        }
+    };
+    add(EntityKind::Mineral, snapshot.minerals);
+    add(EntityKind::Forageable, snapshot.forageables);
+    add(EntityKind::Animal, snapshot.animals);
+    add(EntityKind::Raider, snapshot.raiders);
+    add(EntityKind::House, snapshot.houses);
+
+    *this = SpatialIndex();
+    if (entries.empty()) {
+        return;
+    }
+    float x0 = entries.front().item.x;
+    float x1 = x0;
+    float z0 = entries.front().item.z;
+    float z1 = z0;
+    for (const Entry& e : entries) {
+        x0 = qMin(x0, e.item.x);
+        x1 = qMax(x1, e.item.x);
+        z0 = qMin(z0, e.item.z);
+        z1 = qMax(z1, e.item.z);
+    }
+    // A stray entity far off the map would stretch the grid over empty space, so the cells grow
+    // until the grid has at most MaxCellLoad cells per entity.
+    const double width = double(x1) - x0;
+    const double depth = double(z1) - z0;
+    double cellSize = qMax(1.0, std::sqrt(qMax(width, 1.0) * qMax(depth, 1.0) * CellLoad / entries.size()));
+    while ((width / cellSize + 1) * (depth / cellSize + 1) > MaxCellLoad * entries.size()) {
+        cellSize *= 2;
+    }
+    cellSize_ = float(qMin(cellSize, double(std::numeric_limits<float>::max())));
+    originX_ = x0;
+    originZ_ = z0;
+    columns_ = int(width / cellSize) + 1;
+    rows_ = int(depth / cellSize) + 1;
+
+    // Counting sort by cell and kind; entries keep their list order within a slot.
+    offsets_.assign(size_t(columns_) * rows_ * KindCount + 1, 0);
+    auto slot = [this](const Entry& e) {
+        return (size_t(row(e.item.z)) * columns_ + column(e.item.x)) * KindCount + uint(e.kind);
+    };
+    for (const Entry& e : entries) {
+        ++offsets_[slot(e) + 1];
+    }
+    std::partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+    std::vector<uint> next(offsets_.begin(), offsets_.end() - 1);
+    items_.resize(entries.size());
+    for (const Entry& e : entries) {
+        items_[next[slot(e)]++] = e.item;
+    }
+}
+
+std::vector<EntityRef> SpatialIndex::inRect(const QRectF& rect, KindMask kinds) const
+{
+    std::vector<EntityRef> r;
+    forEachInRect(rect, kinds, [&r](EntityRef e, float, float) {
+        r.push_back(e);
+    });
+    return r;
+}
+
+std::vector<EntityRef> SpatialIndex::inRadius(const QPointF& center, float radius, KindMask kinds) const
+{
+    std::vector<EntityRef> r;
+    const QRectF rect(center.x() - radius, center.y() - radius, radius * 2, radius * 2);
+    const float cx = center.x();
+    const float cz = center.y();
+    forEachInRect(rect, kinds, [&](EntityRef e, float x, float z) {
+        if ((x - cx) * (x - cx) + (z - cz) * (z - cz) <= radius * radius) {
+            r.push_back(e);
+        }
+    });
+    return r;
+}
+
+std::optional<EntityRef> SpatialIndex::nearest(const QPointF& center, float radius, KindMask kinds) const
+{
+    std::optional<EntityRef> r;
+    float best = radius * radius;
+    const QRectF rect(center.x() - radius, center.y() - radius, radius * 2, radius * 2);
+    const float cx = center.x();
+    const float cz = center.y();
+    forEachInRect(rect, kinds, [&](EntityRef e, float x, float z) {
+        const float d = (x - cx) * (x - cx) + (z - cz) * (z - cz);
+        if (d <= best) {
+            best = d;
+            r = e;
+        }
+    });
+    return r;
+}
+
+// Clamped to the grid in float, so far-off or NaN coordinates land in an edge cell.
+int SpatialIndex::column(float x) const
+{
+    const float c = std::floor((x - originX_) / cellSize_);
+    return c >= columns_ - 1 ? columns_ - 1 : c > 0 ? int(c) : 0;
+}
+
+int SpatialIndex::row(float z) const
+{
+    const float r = std::floor((z - originZ_) / cellSize_);
+    return r >= rows_ - 1 ? rows_ - 1 : r > 0 ? int(r) : 0;
+}
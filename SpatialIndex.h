@@ -0,0 +1,115 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include "DataDefines.h"
+
+#include <QPointF>
+#include <QRectF>
+
+#include <optional>
+
+struct GameMapSnapshot;
+
+// The entity lists of a snapshot the spatial index covers.
+enum class EntityKind : quint8
+{
+    Mineral,
+    Forageable,
+    Animal,
+    Raider,
+    House,
+    Count
+};
+
+// An entity by its list in the snapshot and its position in that list.
+struct EntityRef
+{
+    EntityKind kind;
+    uint index;
+};
+
+// Uniform grid over the world x/z plane, sized for a few entities per cell. A cell keeps its
+// entities grouped by kind, so a query only visits the cells it overlaps and the kinds it asks for.
+class SpatialIndex
+{
+public:
+    using KindMask = uint;
+    static constexpr KindMask kindMask(EntityKind kind) { return 1u << uint(kind); }
+    static constexpr KindMask AllKinds = (1u << uint(EntityKind::Count)) - 1;
+
+    void build(const GameMapSnapshot& snapshot);
+    bool isEmpty() const { return items_.empty(); }
+
+    // Calls f(EntityRef, float x, float z) for every entity of `kinds` with x in
+    // [rect.left(), rect.right()] and z in [rect.top(), rect.bottom()], cell by cell.
+    template <typename F>
+    void forEachInRect(const QRectF& rect, KindMask kinds, F&& f) const;
+
+    std::vector<EntityRef> inRect(const QRectF& rect, KindMask kinds) const;
+    std::vector<EntityRef> inRadius(const QPointF& center, float radius, KindMask kinds) const;
+    // The entity of `kinds` closest to `center`, if one is within `radius`.
+    std::optional<EntityRef> nearest(const QPointF& center, float radius, KindMask kinds) const;
+
+private:
+    static constexpr uint KindCount = uint(EntityKind::Count);
+
+    struct Item
+    {
+        float x;
+        float z;
+        uint index;
+    };
+
+    int column(float x) const;
+    int row(float z) const;
+
+    float originX_ = 0;
+    float originZ_ = 0;
+    float cellSize_ = 1;
+    int columns_ = 0;
+    int rows_ = 0;
+    // Entities of kind k in cell c are items_[offsets_[c * KindCount + k]] up to the next offset.
+    std::vector<uint> offsets_;
+    std::vector<Item> items_;
+};
+
+template <typename F>
+void SpatialIndex::forEachInRect(const QRectF& rect, KindMask kinds, F&& f) const
+{
+    if (items_.empty()) {
+        return;
+    }
+    const QRectF r = rect.normalized();
+    const int c0 = column(r.left());
+    const int c1 = column(r.right());
+    const int r0 = row(r.top());
+    const int r1 = row(r.bottom());
+    for (int y = r0; y <= r1; ++y) {
+        for (int x = c0; x <= c1; ++x) {
+            const size_t cell = size_t(y) * columns_ + x;
+            for (uint k = 0; k < KindCount; ++k) {
+                if (!(kinds & (1u << k))) {
+                    continue;
+                }
+                for (uint i = offsets_[cell * KindCount + k]; i < offsets_[cell * KindCount + k + 1]; ++i) {
+                    const Item& item = items_[i];
+                    if (item.x >= r.left() && item.x <= r.right() && item.z >= r.top() && item.z <= r.bottom()) {
+                        f(EntityRef{ EntityKind(k), item.index }, item.x, item.z);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif // SPATIALINDEX_H
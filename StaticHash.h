@@ -0,0 +1,205 @@
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef STATICHASH_H
+#define STATICHASH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+// Perfect hash tables built at compile time. The table searches for a seed that sends every key to
+// a slot of its own, so a lookup is one hash, one slot read and one key compare, and no table needs
+// a static constructor.
+namespace StaticHash
+{
+
+// 128-bit binary form of a UUID in its canonical 8-4-4-4-12 text form.
+struct Uuid
+{
+    std::uint64_t hi = 0;
+    std::uint64_t lo = 0;
+
+    constexpr bool operator==(const Uuid& rhs) const { return hi == rhs.hi && lo == rhs.lo; }
+};
+
+constexpr std::uint64_t mix(std::uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+constexpr std::uint64_t hash(std::uint32_t key, std::uint64_t seed)
+{
+    return mix(key ^ seed);
+}
+
+constexpr std::uint64_t hash(std::string_view key, std::uint64_t seed)
+{
+    std::uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+    for (char c : key) {
+        h ^= std::uint8_t(c);
+        h *= 0x100000001b3ULL;
+    }
+    return mix(h);
+}
+
+constexpr std::uint64_t hash(const Uuid& key, std::uint64_t seed)
+{
+    return mix(key.hi ^ mix(key.lo ^ seed));
+}
+
+constexpr int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Returns false unless `text` is exactly a canonical UUID.
+constexpr bool parseUuid(std::string_view text, Uuid& out)
+{
+    if (text.size() != 36) {
+        return false;
+    }
+    Uuid r;
+    int digits = 0;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            if (text[i] != '-') {
+                return false;
+            }
+            continue;
+        }
+        const int d = hexDigit(text[i]);
+        if (d < 0) {
+            return false;
+        }
+        std::uint64_t& half = digits < 16 ? r.hi : r.lo;
+        half = (half << 4) | std::uint64_t(d);
+        ++digits;
+    }
+    out = r;
+    return true;
+}
+
+// For table literals: a malformed UUID fails the build.
+constexpr Uuid uuid(std::string_view text)
+{
+    Uuid r;
+    if (!parseUuid(text, r)) {
+        throw std::invalid_argument("malformed UUID");
+    }
+    return r;
+}
+
+template<class Key, class Value>
+struct Entry
+{
+    Key key{};
+    Value value{};
+};
+
+template<class Key, class Value, std::size_t N>
+class Table
+{
+public:
+    static_assert(N > 0 && N < 255, "slots store 8-bit entry indices");
+
+    constexpr explicit Table(const Entry<Key, Value> (&entries)[N])
+        : entries_()
+        , slots_()
+    {
+        for (std::size_t i = 0; i < N; ++i) {
+            entries_[i] = entries[i];
+        }
+        for (std::uint64_t seed = 0; seed < MaxSeeds; ++seed) {
+            if (build(seed)) {
+                seed_ = seed;
+                return;
+            }
+        }
+        throw std::logic_error("no perfect hash seed, check for duplicate keys");
+    }
+
+    constexpr const Value* find(const Key& key) const
+    {
+        const std::uint8_t i = slots_[hash(key, seed_) & (Slots - 1)];
+        if (i != Empty && entries_[i].key == key) {
+            return &entries_[i].value;
+        }
+        return nullptr;
+    }
+
+    constexpr Value value(const Key& key, Value fallback) const
+    {
+        const Value* v = find(key);
+        return v ? *v : fallback;
+    }
+
+    constexpr const std::array<Entry<Key, Value>, N>& entries() const { return entries_; }
+
+private:
+    static constexpr std::size_t slotCount()
+    {
+        // About 1/16 load keeps the expected seed search to a few rounds.
+        std::size_t r = 1;
+        while (r < N * 16) {
+            r <<= 1;
+        }
+        return r;
+    }
+
+    static constexpr std::size_t Slots = slotCount();
+    static constexpr std::uint8_t Empty = 0xff;
+    static constexpr std::uint64_t MaxSeeds = 256;
+
+    constexpr bool build(std::uint64_t seed)
+    {
+        for (auto& s : slots_) {
+            s = Empty;
+        }
+        for (std::size_t i = 0; i < N; ++i) {
+            std::uint8_t& s = slots_[hash(entries_[i].key, seed) & (Slots - 1)];
+            if (s != Empty) {
+                return false;
+            }
+            s = std::uint8_t(i);
+        }
+        return true;
+    }
+
+    std::array<Entry<Key, Value>, N> entries_;
+    std::array<std::uint8_t, Slots> slots_;
+    std::uint64_t seed_ = 0;
+};
+
+template<class Key, class Value, std::size_t N>
+constexpr Table<Key, Value, N> makeTable(const Entry<Key, Value> (&entries)[N])
+{
+    return Table<Key, Value, N>(entries);
+}
+
+}
+
+#endif // STATICHASH_H
@@ -22,7 +22,18 @@
 #include <QtWidgets>
 #include <QtConcurrent>
 
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <set>
 #include <vector>
 #include <utility>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FF_SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define FF_SIMD_SSE2 0
+#endif